@@ -1,7 +1,15 @@
 #include "jack.hpp"
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <algorithm>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 namespace Jack {
 
@@ -44,23 +52,204 @@ static bool handle_status(int status)
 
 //=============================================================================
 
+// cheapest clock there is, in cycles on x86 and the given
+// time in microseconds elsewhere.
+static inline unsigned long long read_cycle_counter(jack_time_t time) {
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    unsigned int lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
+#else
+    return (unsigned long long)time;
+#endif
+}
+
+//=============================================================================
+
+class LibJackBackend : public Backend {
+public:
+    virtual jack_client_t *client_open(const char *name, jack_status_t *status) {
+        return jack_client_open(name, JackNullOption, status);
+    }
+    
+    virtual int client_close(jack_client_t *client) {
+        return jack_client_close(client);
+    }
+    
+    virtual int activate(jack_client_t *client) {
+        return jack_activate(client);
+    }
+    
+    virtual int deactivate(jack_client_t *client) {
+        return jack_deactivate(client);
+    }
+    
+    virtual int set_process_callback(jack_client_t *client, 
+        JackProcessCallback callback, void *arg) {
+        return jack_set_process_callback(client, callback, arg);
+    }
+    
+    virtual int set_sample_rate_callback(jack_client_t *client, 
+        JackSampleRateCallback callback, void *arg) {
+        return jack_set_sample_rate_callback(client, callback, arg);
+    }
+    
+    virtual int set_sync_callback(jack_client_t *client, 
+        JackSyncCallback callback, void *arg) {
+        return jack_set_sync_callback(client, callback, arg);
+    }
+    
+    virtual int set_latency_callback(jack_client_t *client, 
+        JackLatencyCallback callback, void *arg) {
+        return jack_set_latency_callback(client, callback, arg);
+    }
+    
+    virtual int set_xrun_callback(jack_client_t *client, 
+        JackXRunCallback callback, void *arg) {
+        return jack_set_xrun_callback(client, callback, arg);
+    }
+    
+    virtual int set_freewheel_callback(jack_client_t *client, 
+        JackFreewheelCallback callback, void *arg) {
+        return jack_set_freewheel_callback(client, callback, arg);
+    }
+    
+    virtual void on_shutdown(jack_client_t *client, 
+        JackShutdownCallback callback, void *arg) {
+        jack_on_shutdown(client, callback, arg);
+    }
+    
+    virtual jack_transport_state_t transport_query(jack_client_t *client, 
+        jack_position_t *pos) {
+        return jack_transport_query(client, pos);
+    }
+    
+    virtual int transport_locate(jack_client_t *client, jack_nframes_t frame) {
+        return jack_transport_locate(client, frame);
+    }
+    
+    virtual void transport_start(jack_client_t *client) {
+        jack_transport_start(client);
+    }
+    
+    virtual void transport_stop(jack_client_t *client) {
+        jack_transport_stop(client);
+    }
+    
+    virtual int set_timebase_callback(jack_client_t *client, int conditional,
+        JackTimebaseCallback callback, void *arg) {
+        return jack_set_timebase_callback(client, conditional, callback, arg);
+    }
+    
+    virtual int release_timebase(jack_client_t *client) {
+        return jack_release_timebase(client);
+    }
+    
+    virtual int set_freewheel(jack_client_t *client, int onoff) {
+        return jack_set_freewheel(client, onoff);
+    }
+    
+    virtual jack_time_t get_time() {
+        return jack_get_time();
+    }
+    
+    virtual jack_port_t *port_register(jack_client_t *client, const char *name, 
+        const char *type, unsigned long flags, unsigned long buffer_size) {
+        return jack_port_register(client, name, type, flags, buffer_size);
+    }
+    
+    virtual int port_unregister(jack_client_t *client, jack_port_t *port) {
+        return jack_port_unregister(client, port);
+    }
+    
+    virtual void *port_get_buffer(jack_port_t *port, jack_nframes_t nframes) {
+        return jack_port_get_buffer(port, nframes);
+    }
+    
+    virtual void port_get_latency_range(jack_port_t *port, 
+        jack_latency_callback_mode_t mode, jack_latency_range_t *range) {
+        jack_port_get_latency_range(port, mode, range);
+    }
+    
+    virtual jack_nframes_t midi_get_event_count(void *buffer) {
+        return jack_midi_get_event_count(buffer);
+    }
+    
+    virtual int midi_event_get(jack_midi_event_t *event, void *buffer, 
+        uint32_t index) {
+        return jack_midi_event_get(event, buffer, index);
+    }
+    
+    virtual void midi_clear_buffer(void *buffer) {
+        jack_midi_clear_buffer(buffer);
+    }
+    
+    virtual size_t midi_max_event_size(void *buffer) {
+        return jack_midi_max_event_size(buffer);
+    }
+    
+    virtual int midi_event_write(void *buffer, jack_nframes_t time, 
+        const jack_midi_data_t *data, size_t size) {
+        return jack_midi_event_write(buffer, time, data, size);
+    }
+    
+    virtual jack_midi_data_t *midi_event_reserve(void *buffer, 
+        jack_nframes_t time, size_t size) {
+        return jack_midi_event_reserve(buffer, time, size);
+    }
+    
+    virtual uint32_t midi_get_lost_event_count(void *buffer) {
+        return jack_midi_get_lost_event_count(buffer);
+    }
+};
+
+Backend &get_jack_backend() {
+    static LibJackBackend backend;
+    return backend;
+}
+
+//=============================================================================
+
+static void sleep_ms(int ms) {
+#if defined(WIN32)
+    Sleep(ms);
+#else
+    usleep(ms*1000);
+#endif
+}
+
+//=============================================================================
+
 int Client::process_callback(jack_nframes_t size, void *arg) {
     Client *client = (Client *)arg;
-    for (PortList::iterator i = client->ports.begin(); i != client->ports.end(); ++i) {
+    client->stats.begin_period(client->backend->get_time());
+    if (client->process_ports_pending) {
+        client->process_index = 1 - client->process_index;
+        client->process_ports_pending = false;
+    }
+    PortArray &ports = client->process_ports[client->process_index];
+    for (PortArray::iterator i = ports.begin(); i != ports.end(); ++i) {
         (*i)->update_buffer(size);
     }
     client->on_process(size);
+    for (PortArray::iterator i = ports.begin(); i != ports.end(); ++i) {
+        (*i)->flush();
+    }
+    client->stats.end_period(size, client->backend->get_time());
     return 0;
 }
 
 int Client::sample_rate_callback(jack_nframes_t nframes, void *arg) {
     Client *client = (Client *)arg;
+    client->stats.set_sample_rate(nframes);
     client->on_sample_rate(nframes);
 	return 0;
 }
 
 void Client::shutdown_callback(void *arg) {
     Client *client = (Client *)arg;
+    // the process callback is not called anymore
+    client->active = false;
     client->on_shutdown();
 }
 
@@ -74,16 +263,54 @@ int Client::sync_callback(jack_transport_state_t state, jack_position_t *pos, vo
     return client->on_sync(state, *pos)?1:0;
 }
 
-Client::Client(const char *name) {
+int Client::xrun_callback(void *arg) {
+    Client *client = (Client *)arg;
+    client->stats.add_xrun();
+    client->on_xrun();
+    return 0;
+}
+
+void Client::freewheel_callback(int starting, void *arg) {
+    Client *client = (Client *)arg;
+    client->freewheeling = (starting != 0);
+    client->on_freewheel(starting != 0);
+}
+
+void Client::latency_callback(jack_latency_callback_mode_t mode, void *arg) {
+    Client *client = (Client *)arg;
+    // picked up outside the notification thread
+    if (mode == JackPlaybackLatency)
+        client->latency_pending = true;
+}
+
+void Client::timebase_callback(jack_transport_state_t state, jack_nframes_t size,
+                               jack_position_t *pos, int new_pos, void *arg) {
+    Client *client = (Client *)arg;
+    assert(pos);
+    client->on_timebase(state, size, *pos, new_pos != 0);
+}
+
+Client::Client(const char *name, Backend *backend) {
     this->name = name;
+    this->backend = backend?backend:&get_jack_backend();
     handle = NULL;
     nframes = 0;
+    active = false;
+    timebase_master = false;
+    latency_pending = true;
+    freewheeling = false;
+    process_index = 0;
+    process_ports_pending = false;
 }
 
 bool Client::is_created() {
     return handle != NULL;
 }
 
+bool Client::is_active() const {
+    return active;
+}
+
 Client::~Client() {
     assert(!handle); // you must call shutdown() before deleting the instance
     assert(ports.empty()); // you must delete all ports before deleting the client
@@ -93,25 +320,34 @@ bool Client::init() {
     assert(!handle); // you must call shutdown() before init
     
     jack_status_t status;
-    handle = jack_client_open(name.c_str(),
-                              JackNullOption,
-                              &status);
+    handle = backend->client_open(name.c_str(), &status);
     if (handle_status(status))
     {
-		handle_status(jack_set_process_callback(
+		handle_status(backend->set_process_callback(
 				handle, &process_callback, this));
 
-		handle_status(jack_set_sample_rate_callback(
+		handle_status(backend->set_sample_rate_callback(
 				handle, &sample_rate_callback, this));
 
-        handle_status(jack_set_sync_callback(
+        handle_status(backend->set_sync_callback(
 				handle, &sync_callback, this));
 
-		jack_on_shutdown(handle, &shutdown_callback, this);
+        handle_status(backend->set_latency_callback(
+				handle, &latency_callback, this));
+
+        handle_status(backend->set_xrun_callback(
+				handle, &xrun_callback, this));
+
+        handle_status(backend->set_freewheel_callback(
+				handle, &freewheel_callback, this));
+
+		backend->on_shutdown(handle, &shutdown_callback, this);
         
         for (PortList::iterator i = ports.begin(); i != ports.end(); ++i) {
-            (*i)->init();
+            if ((*i)->enabled)
+                (*i)->init();
         }
+        update_process_ports();
         
         return true;
     }
@@ -120,54 +356,172 @@ bool Client::init() {
 }
 
 void Client::activate() {
-    jack_activate(handle);
+    backend->activate(handle);
+    active = true;
 }
 
 void Client::deactivate() {
-    jack_deactivate(handle);
+    backend->deactivate(handle);
+    active = false;
+    wait_for_process_ports();
 }
 
 void Client::shutdown() {
     assert(handle);
     
     for (PortList::iterator i = ports.begin(); i != ports.end(); ++i) {
-        (*i)->shutdown();
+        if ((*i)->handle)
+            (*i)->shutdown();
     }
-    handle_status(jack_client_close(handle));
+    handle_status(backend->client_close(handle));
     handle = NULL;
-    
+    active = false;
+    timebase_master = false;
+    process_ports[0].clear();
+    process_ports[1].clear();
+    process_ports_pending = false;
 }
 
 TransportState Client::transport_query(Position *pos) {
     assert(handle);
-    return jack_transport_query(handle, pos);
+    return backend->transport_query(handle, pos);
 }
 
 void Client::add_port(Port *port) {
     ports.push_back(port);
-    if (handle) // port came after init, so post-init it
+    // port came after init, so post-init it. the port is still
+    // under construction, so the process callback gets it with
+    // the next update.
+    if (handle && port->enabled)
         port->init();
 }
 
 void Client::remove_port(Port *port) {
-    if (port->handle) // port has not been shut down, so do it now
-        port->shutdown();
     ports.remove(port);
+    if (port->handle) { // port has not been shut down, so do it now
+        // make sure the process callback is done with the port first,
+        // otherwise leave it registered until the client is closed
+        if (release_process_ports())
+            port->shutdown();
+    }
+}
+
+void Client::set_port_enabled(Port &port, bool enabled) {
+    if (port.enabled == enabled)
+        return;
+    port.enabled = enabled;
+    if (!handle)
+        return;
+    if (enabled) {
+        // may still be registered if it could not be released
+        if (!port.handle)
+            port.init();
+        update_process_ports();
+    } else if (release_process_ports()) {
+        port.shutdown();
+    }
+}
+
+bool Client::update_process_ports() {
+    // the callback may still switch to the other array
+    if (!wait_for_process_ports())
+        return false;
+    int index = 1 - process_index;
+    PortArray &array = process_ports[index];
+    array.clear();
+    for (PortList::iterator i = ports.begin(); i != ports.end(); ++i) {
+        if ((*i)->handle && (*i)->enabled)
+            array.push_back(*i);
+    }
+    process_ports_pending = true;
+    return wait_for_process_ports();
+}
+
+bool Client::release_process_ports() {
+    // a slow callback may still be using the old array, so
+    // the ports can only go once it switched
+    for (int i = 0; i < 5; ++i) {
+        if (!is_active()) {
+            // no callback runs, so nothing to wait for
+            return update_process_ports();
+        }
+        if (update_process_ports())
+            return true;
+        printf("JACK: process callback did not respond, retrying.\n");
+    }
+    // the server is gone or dropped the client
+    printf("JACK: process callback is stuck, ports are not released.\n");
+    return false;
+}
+
+bool Client::wait_for_process_ports() {
+    // the callback switches within one period
+    for (int i = 0; process_ports_pending && (i < 1000); ++i) {
+        if (!active || !backend->runs_process_thread()) {
+            // no callback runs, so switch on our own
+            process_index = 1 - process_index;
+            process_ports_pending = false;
+            break;
+        }
+        sleep_ms(1);
+    }
+    return !process_ports_pending;
 }
 
 void Client::transport_locate(NFrames frame) {
     assert(handle);
-    jack_transport_locate(handle, frame);
+    backend->transport_locate(handle, frame);
 }
 
 void Client::transport_start() {
     assert(handle);
-    jack_transport_start(handle);
+    backend->transport_start(handle);
 }
 
 void Client::transport_stop() {
     assert(handle);
-    jack_transport_stop(handle);
+    backend->transport_stop(handle);
+}
+
+bool Client::set_timebase_master(bool enable) {
+    assert(handle);
+    if (enable == timebase_master)
+        return true;
+    if (enable) {
+        if (backend->set_timebase_callback(handle, 0, &timebase_callback, this)) {
+            printf("JACK: unable to become timebase master.\n");
+            return false;
+        }
+    } else {
+        backend->release_timebase(handle);
+    }
+    timebase_master = enable;
+    return true;
+}
+
+bool Client::is_timebase_master() const {
+    return timebase_master;
+}
+
+const ProcessStats &Client::get_stats() const {
+    return stats;
+}
+
+void Client::set_freewheel(bool enable) {
+    assert(handle);
+    if (backend->set_freewheel(handle, enable?1:0))
+        printf("JACK: unable to change freewheel mode.\n");
+}
+
+bool Client::is_freewheeling() const {
+    return freewheeling;
+}
+
+bool Client::latency_changed() {
+    if (!latency_pending)
+        return false;
+    latency_pending = false;
+    return true;
 }
 
 
@@ -179,6 +533,7 @@ Port::Port(Client &client,
            unsigned long flags,
            unsigned long buffer_size) {
     handle = NULL;
+    enabled = true;
     this->client = &client;
     this->name = name;
     this->type = type;
@@ -195,7 +550,7 @@ Port::~Port() {
 void Port::init() {
     assert(!handle);
     assert(client->handle);
-    handle = jack_port_register(client->handle, 
+    handle = get_backend().port_register(client->handle, 
                                 name.c_str(), 
                                 type.c_str(), 
                                 flags, 
@@ -205,12 +560,36 @@ void Port::init() {
 void Port::shutdown() {
     assert(handle);
     assert(client->handle);
-    handle_status(jack_port_unregister(client->handle, handle));
+    handle_status(get_backend().port_unregister(client->handle, handle));
     handle = NULL;
 }
 
+bool Port::is_registered() const {
+    return (handle != NULL);
+}
+
+bool Port::is_enabled() const {
+    return enabled;
+}
+
+NFrames Port::get_playback_latency() {
+    if (!handle)
+        return 0;
+    jack_latency_range_t range;
+    get_backend().port_get_latency_range(handle, JackPlaybackLatency, &range);
+    return range.max;
+}
+
 void *Port::get_buffer(jack_nframes_t nframes) {
-    return jack_port_get_buffer(handle, nframes);
+    return get_backend().port_get_buffer(handle, nframes);
+}
+
+Backend &Port::get_backend() {
+    return *client->backend;
+}
+
+void Port::report_lost_events(unsigned int count) {
+    client->stats.add_lost_events(count);
 }
 
 //=============================================================================
@@ -232,19 +611,29 @@ MIDIPort::MIDIPort(Client &client,
                    const char *name,
                    unsigned long flags) 
  : Port(client, name, JACK_DEFAULT_MIDI_TYPE, flags, 0) {
-    
+    buffer = NULL;
+    buffer_frames = 0;
+    queued_events.resize(MaxQueuedEvents);
+    queued_count = 0;
+    pending_count = 0;
+    lost_count = 0;
+    overflow_count = 0;
 }
 
 void MIDIPort::update_buffer(jack_nframes_t nframes) {
     buffer = get_buffer(nframes);
+    buffer_frames = nframes;
+    // anything else still queued is left over from before the
+    // port was processed
+    queued_count = pending_count;
 }
 
 NFrames MIDIPort::get_event_count() {
-    return jack_midi_get_event_count(buffer);
+    return get_backend().midi_get_event_count(buffer);
 }
 
 bool MIDIPort::get_event(MIDIEvent &event, NFrames index) {
-    return (jack_midi_event_get(&event, buffer, index) == 0);
+    return (get_backend().midi_event_get(&event, buffer, index) == 0);
 }
 
 bool MIDIPort::get_event(MIDI::Message &msg, NFrames *time, NFrames index) {
@@ -261,15 +650,15 @@ bool MIDIPort::get_event(MIDI::Message &msg, NFrames *time, NFrames index) {
 }
 
 void MIDIPort::clear_buffer() {
-    jack_midi_clear_buffer(buffer);
+    get_backend().midi_clear_buffer(buffer);
 }
 
 size_t MIDIPort::max_event_size() {
-    return jack_midi_max_event_size(buffer);
+    return get_backend().midi_max_event_size(buffer);
 }
 
 bool MIDIPort::write_event(NFrames time, MIDIData *data, size_t size) {
-    return (jack_midi_event_write(buffer, time, data, size) == 0);
+    return (get_backend().midi_event_write(buffer, time, data, size) == 0);
 }
 
 bool MIDIPort::write_event(NFrames time, const MIDI::Message &msg) {
@@ -277,11 +666,207 @@ bool MIDIPort::write_event(NFrames time, const MIDI::Message &msg) {
 }
 
 NFrames MIDIPort::get_lost_event_count() {
-    return jack_midi_get_lost_event_count(buffer);
+    return get_backend().midi_get_lost_event_count(buffer);
 }
 
 MIDIData *MIDIPort::reserve_events(NFrames time, size_t size) {
-    return jack_midi_event_reserve(buffer, time, size);
+    return get_backend().midi_event_reserve(buffer, time, size);
+}
+
+bool MIDIPort::queue_event(NFrames time, const MIDI::Message &msg) {
+    if (queued_count >= (int)queued_events.size()) {
+        overflow_count++;
+        return false;
+    }
+    QueuedEvent &event = queued_events[queued_count++];
+    event.time = time;
+    event.msg = msg;
+    return true;
+}
+
+int MIDIPort::get_queue_room() const {
+    return (int)queued_events.size() - queued_count;
+}
+
+void MIDIPort::discard_events() {
+    int count = 0;
+    int pending = 0;
+    for (int i = 0; i < queued_count; ++i) {
+        const MIDI::Message &msg = queued_events[i].msg;
+        if ((msg.status < MIDI::StatusSysEx) || 
+            (msg.status == MIDI::StatusTimingClock))
+            continue;
+        if (i < pending_count)
+            pending++;
+        queued_events[count++] = queued_events[i];
+    }
+    queued_count = count;
+    pending_count = pending;
+}
+
+void MIDIPort::flush() {
+    if (!(flags & JackPortIsOutput))
+        return;
+    // the buffer contents are undefined in every period
+    clear_buffer();
+    
+    // streams arrive mostly in order, so insertion sort is cheap
+    // and keeps equal timestamps in queue order.
+    for (int i = 1; i < queued_count; ++i) {
+        QueuedEvent event = queued_events[i];
+        int j = i;
+        while ((j > 0) && (queued_events[j-1].time > event.time)) {
+            queued_events[j] = queued_events[j-1];
+            j--;
+        }
+        queued_events[j] = event;
+    }
+    
+    int i = 0;
+    for (; (i < queued_count) && (queued_events[i].time < buffer_frames); ++i) {
+        const QueuedEvent &event = queued_events[i];
+        size_t size = (size_t)event.msg.get_size();
+        MIDIData *data = reserve_events(event.time, size);
+        if (!data)
+            continue;
+        memcpy(data, event.msg.bytes, size);
+    }
+    NFrames lost = get_lost_event_count();
+    if (lost) {
+        lost_count += lost;
+        report_lost_events(lost);
+    }
+    // keep the rest for the next period
+    pending_count = 0;
+    for (; i < queued_count; ++i) {
+        QueuedEvent &event = queued_events[pending_count++];
+        event = queued_events[i];
+        event.time -= buffer_frames;
+    }
+    queued_count = pending_count;
+}
+
+unsigned int MIDIPort::get_lost_count() const {
+    return lost_count;
+}
+
+unsigned int MIDIPort::get_overflow_count() const {
+    return overflow_count;
+}
+
+//=============================================================================
+
+ProcessStats::ProcessStats() {
+    sample_rate = 44100;
+    reset();
+}
+
+void ProcessStats::reset() {
+    periods = 0;
+    xruns = 0;
+    events = 0;
+    lost_events = 0;
+    for (int i = 0; i < LoadBins; ++i) {
+        load_histogram[i] = 0;
+    }
+    load = 0.0f;
+    max_load = 0.0f;
+    max_period_events = 0;
+    queue_fill = 0.0f;
+    max_queue_fill = 0.0f;
+    min_ahead = -1;
+    period_events = 0;
+    period_start = 0;
+    calibration_cycles = 0;
+    calibration_time = 0;
+    cycles_per_usec = 0.0;
+}
+
+void ProcessStats::set_sample_rate(NFrames sample_rate) {
+    this->sample_rate = sample_rate;
+}
+
+void ProcessStats::begin_period(jack_time_t time) {
+    period_start = read_cycle_counter(time);
+    period_events = 0;
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    if (!calibration_time) {
+        calibration_time = time;
+        calibration_cycles = period_start;
+    } else if ((time - calibration_time) >= 1000000) {
+        // the rate is refined over longer stretches of time
+        cycles_per_usec = (double)(period_start - calibration_cycles) / 
+            (double)(time - calibration_time);
+    }
+#else
+    cycles_per_usec = 1.0;
+#endif
+}
+
+void ProcessStats::end_period(NFrames size, jack_time_t time) {
+    unsigned long long cycles = read_cycle_counter(time) - period_start;
+    periods++;
+    if ((period_events > max_period_events))
+        max_period_events = period_events;
+    if ((cycles_per_usec <= 0.0) || !size || !sample_rate)
+        return; // not calibrated yet
+    double usecs = (double)cycles / cycles_per_usec;
+    double period_usecs = (double)size * 1000000.0 / (double)sample_rate;
+    float period_load = (float)(usecs / period_usecs);
+    load = period_load;
+    if (period_load > max_load)
+        max_load = period_load;
+    int bin = std::min((int)(period_load * (LoadBins - 1)), (int)LoadBins - 1);
+    load_histogram[std::max(bin, 0)]++;
+}
+
+void ProcessStats::add_events(int count) {
+    period_events += count;
+    events += count;
+}
+
+void ProcessStats::add_lost_events(unsigned int count) {
+    lost_events += count;
+}
+
+void ProcessStats::add_xrun() {
+    xruns++;
+}
+
+void ProcessStats::set_queue_status(float fill, int ahead) {
+    queue_fill = fill;
+    if (fill > max_queue_fill)
+        max_queue_fill = fill;
+    if ((min_ahead < 0) || (ahead < min_ahead))
+        min_ahead = ahead;
+}
+
+void ProcessStats::print() const {
+    printf("periods: %u, xruns: %u, events: %u (max %i per period), lost: %u\n",
+        periods, xruns, events, max_period_events, lost_events);
+    printf("load: %.1f%% (max %.1f%%), queue fill: %.1f%% (max %.1f%%)",
+        load * 100.0f, max_load * 100.0f, 
+        queue_fill * 100.0f, max_queue_fill * 100.0f);
+    if (min_ahead >= 0)
+        printf(", premixed ahead: %i samples minimum", min_ahead);
+    printf("\n");
+    unsigned int total = 0;
+    for (int i = 0; i < LoadBins; ++i) {
+        total += load_histogram[i];
+    }
+    if (!total)
+        return;
+    for (int i = 0; i < LoadBins; ++i) {
+        if (i < (LoadBins - 1))
+            printf("%3i-%3i%%: ", i * 10, (i + 1) * 10);
+        else
+            printf("   >100%%: ");
+        int width = (int)((unsigned long long)load_histogram[i] * 50 / total);
+        for (int j = 0; j < width; ++j) {
+            printf("#");
+        }
+        printf(" %u\n", load_histogram[i]);
+    }
 }
 
 //=============================================================================
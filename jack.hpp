@@ -9,6 +9,7 @@
 
 #include <string>
 #include <list>
+#include <vector>
 
 #include "midi.hpp"
 
@@ -20,6 +21,72 @@ class Client;
     
 //=============================================================================
 
+// the calls a client makes into libjack. clients can be run
+// on something else than a JACK server by passing another
+// backend, such as MockBackend.
+class Backend {
+public:
+    virtual ~Backend() {}
+    
+    // returns false if the process callback is only called
+    // on demand from the thread that controls the client.
+    virtual bool runs_process_thread() const { return true; }
+    
+    virtual jack_client_t *client_open(const char *name, jack_status_t *status) = 0;
+    virtual int client_close(jack_client_t *client) = 0;
+    virtual int activate(jack_client_t *client) = 0;
+    virtual int deactivate(jack_client_t *client) = 0;
+    
+    virtual int set_process_callback(jack_client_t *client, 
+        JackProcessCallback callback, void *arg) = 0;
+    virtual int set_sample_rate_callback(jack_client_t *client, 
+        JackSampleRateCallback callback, void *arg) = 0;
+    virtual int set_sync_callback(jack_client_t *client, 
+        JackSyncCallback callback, void *arg) = 0;
+    virtual int set_latency_callback(jack_client_t *client, 
+        JackLatencyCallback callback, void *arg) = 0;
+    virtual int set_xrun_callback(jack_client_t *client, 
+        JackXRunCallback callback, void *arg) = 0;
+    virtual int set_freewheel_callback(jack_client_t *client, 
+        JackFreewheelCallback callback, void *arg) = 0;
+    virtual void on_shutdown(jack_client_t *client, 
+        JackShutdownCallback callback, void *arg) = 0;
+    
+    virtual jack_transport_state_t transport_query(jack_client_t *client, 
+        jack_position_t *pos) = 0;
+    virtual int transport_locate(jack_client_t *client, jack_nframes_t frame) = 0;
+    virtual void transport_start(jack_client_t *client) = 0;
+    virtual void transport_stop(jack_client_t *client) = 0;
+    virtual int set_timebase_callback(jack_client_t *client, int conditional,
+        JackTimebaseCallback callback, void *arg) = 0;
+    virtual int release_timebase(jack_client_t *client) = 0;
+    virtual int set_freewheel(jack_client_t *client, int onoff) = 0;
+    virtual jack_time_t get_time() = 0;
+    
+    virtual jack_port_t *port_register(jack_client_t *client, const char *name, 
+        const char *type, unsigned long flags, unsigned long buffer_size) = 0;
+    virtual int port_unregister(jack_client_t *client, jack_port_t *port) = 0;
+    virtual void *port_get_buffer(jack_port_t *port, jack_nframes_t nframes) = 0;
+    virtual void port_get_latency_range(jack_port_t *port, 
+        jack_latency_callback_mode_t mode, jack_latency_range_t *range) = 0;
+    
+    virtual jack_nframes_t midi_get_event_count(void *buffer) = 0;
+    virtual int midi_event_get(jack_midi_event_t *event, void *buffer, 
+        uint32_t index) = 0;
+    virtual void midi_clear_buffer(void *buffer) = 0;
+    virtual size_t midi_max_event_size(void *buffer) = 0;
+    virtual int midi_event_write(void *buffer, jack_nframes_t time, 
+        const jack_midi_data_t *data, size_t size) = 0;
+    virtual jack_midi_data_t *midi_event_reserve(void *buffer, 
+        jack_nframes_t time, size_t size) = 0;
+    virtual uint32_t midi_get_lost_event_count(void *buffer) = 0;
+};
+
+// returns the backend talking to the JACK server
+Backend &get_jack_backend();
+
+//=============================================================================
+
 class Port {
 friend class Client;
 public:
@@ -36,14 +103,27 @@ public:
     
     virtual ~Port();
 
+    bool is_registered() const;
+    bool is_enabled() const;
+    // latency of the signal path behind an output port in
+    // samples, or 0 if the port is not registered.
+    NFrames get_playback_latency();
+
 protected:
     virtual void update_buffer(jack_nframes_t nframes) = 0;
+    // called at the end of each period
+    virtual void flush() {}
     void *get_buffer(jack_nframes_t nframes);
+    // adds to the lost events in the client statistics
+    void report_lost_events(unsigned int count);
+    Backend &get_backend();
     void init();
     void shutdown();
 
     Client *client;
     jack_port_t *handle;
+    // port should be registered while the client runs
+    bool enabled;
     std::string name; 
     std::string type;
     unsigned long flags;
@@ -73,6 +153,11 @@ typedef jack_midi_data_t MIDIData;
 
 class MIDIPort : public Port {
 public:
+    enum {
+        // how many events can be queued per period
+        MaxQueuedEvents = 1024,
+    };
+    
     MIDIPort(Client &client, 
              const char *name,
              unsigned long flags);
@@ -91,11 +176,40 @@ public:
     bool write_event(NFrames time, const MIDI::Message &msg);
     NFrames get_lost_event_count();
     MIDIData *reserve_events(NFrames time, size_t size);
+    
+    // per-period output stage: messages are queued in any order
+    // and written sorted by time with flush(). messages past the
+    // end of the period are held back for the next ones.
+    bool queue_event(NFrames time, const MIDI::Message &msg);
+    virtual void flush();
+    // how many more events can be queued
+    int get_queue_room() const;
+    // drops queued channel messages and clock ticks, transport
+    // messages are kept.
+    void discard_events();
+    
+    // events the port buffer had no room for
+    unsigned int get_lost_count() const;
+    // events that did not fit into the queue
+    unsigned int get_overflow_count() const;
 
 protected:
     virtual void update_buffer(jack_nframes_t nframes);
 
+    struct QueuedEvent {
+        NFrames time;
+        MIDI::Message msg;
+    };
+    typedef std::vector<QueuedEvent> QueuedEventArray;
+
     void *buffer;
+    NFrames buffer_frames;
+    QueuedEventArray queued_events;
+    int queued_count;
+    // events at the front of the queue that are due in later periods
+    int pending_count;
+    volatile unsigned int lost_count;
+    volatile unsigned int overflow_count;
 };
 
 //=============================================================================
@@ -103,11 +217,64 @@ protected:
 typedef jack_transport_state_t TransportState;
 typedef jack_position_t Position;
 
+// statistics of the process callback. only the process thread
+// writes, other threads read without locking and may see
+// counters from different periods.
+class ProcessStats {
+public:
+    enum {
+        // load histogram in 10% steps of the period length,
+        // the last bin counts periods that took too long
+        LoadBins = 11,
+    };
+    
+    ProcessStats();
+    // must not be called while the client runs
+    void reset();
+    void set_sample_rate(NFrames sample_rate);
+    
+    // realtime methods, time is the JACK clock in microseconds
+    void begin_period(jack_time_t time);
+    void end_period(NFrames size, jack_time_t time);
+    void add_events(int count);
+    void add_lost_events(unsigned int count);
+    void add_xrun();
+    // fill of the message queue in 0-1, and how many samples
+    // are premixed ahead
+    void set_queue_status(float fill, int ahead);
+    
+    void print() const;
+    
+    volatile unsigned int periods;
+    volatile unsigned int xruns;
+    volatile unsigned int events;
+    volatile unsigned int lost_events;
+    volatile unsigned int load_histogram[LoadBins];
+    // load of the last period and the highest seen, in 0-1
+    volatile float load;
+    volatile float max_load;
+    volatile int max_period_events;
+    volatile float queue_fill;
+    volatile float max_queue_fill;
+    // lowest number of samples premixed ahead, -1 if unknown
+    volatile int min_ahead;
+    
+protected:
+    NFrames sample_rate;
+    int period_events;
+    unsigned long long period_start;
+    // cycle counter calibration against the JACK clock
+    unsigned long long calibration_cycles;
+    jack_time_t calibration_time;
+    double cycles_per_usec;
+};
+
 class Client {
     friend class Port;
 
 public:
-    Client(const char *name);
+    // uses get_jack_backend() if backend is NULL
+    Client(const char *name, Backend *backend=NULL);
     virtual ~Client();
 
     bool init();
@@ -117,6 +284,7 @@ public:
     void deactivate();
 
     bool is_created();
+    bool is_active() const;
 
     TransportState transport_query(Position *pos);
     void transport_locate(NFrames frame);
@@ -126,22 +294,78 @@ public:
     virtual void on_process(NFrames size) {}
     virtual void on_sample_rate(NFrames nframes) {}
     virtual void on_shutdown() {}
+    virtual void on_xrun() {}
+    virtual void on_freewheel(bool starting) {}
     virtual bool on_sync(TransportState state, const Position &pos) { return true; }
-        
+    // called as timebase master to fill in the BBT fields of pos.
+    virtual void on_timebase(TransportState state, NFrames size, 
+                             Position &pos, bool new_pos) {}
+    
+    // returns true once after port latencies changed
+    bool latency_changed();
+    
+    const ProcessStats &get_stats() const;
+    
+    // in freewheel mode, the process callback runs as fast
+    // as possible and is no longer realtime.
+    void set_freewheel(bool enable);
+    bool is_freewheeling() const;
+    
+    // becomes or stops being the timebase master. returns
+    // false if the timebase could not be taken over.
+    bool set_timebase_master(bool enable);
+    bool is_timebase_master() const;
+    
+    // registers or releases a port. must not be called from
+    // the process callback.
+    void set_port_enabled(Port &port, bool enabled);
+    
 protected:
     void add_port(Port *port);
     void remove_port(Port *port);
+    
+    // publishes the registered ports to the process callback
+    // and waits until it picked them up. ports can be added and
+    // removed from any non-realtime thread this way. returns
+    // false if the callback did not respond within a second;
+    // the ports are then picked up later.
+    bool update_process_ports();
+    // like update_process_ports(), but retries for a few seconds
+    // until the callback no longer uses ports that are about to be
+    // released. returns false if it still might, the ports must
+    // stay registered then.
+    bool release_process_ports();
+    // waits for a pending switch. while the client is active,
+    // only the callback switches.
+    bool wait_for_process_ports();
 
     typedef std::list<Port *> PortList;
+    typedef std::vector<Port *> PortArray;
     PortList ports;
+    // the process callback only uses process_ports[process_index],
+    // and switches to the other array if process_ports_pending is set.
+    PortArray process_ports[2];
+    volatile int process_index;
+    volatile bool process_ports_pending;
     std::string name;
+    Backend *backend;
     jack_client_t *handle;
     jack_nframes_t nframes;
+    volatile bool active;
+    bool timebase_master;
+    volatile bool latency_pending;
+    volatile bool freewheeling;
+    ProcessStats stats;
     
     static int process_callback(jack_nframes_t size, void *arg);
     static int sample_rate_callback(jack_nframes_t nframes, void *arg);
     static void shutdown_callback(void *arg);
     static int sync_callback(jack_transport_state_t state, jack_position_t *pos, void *arg);
+    static int xrun_callback(void *arg);
+    static void freewheel_callback(int starting, void *arg);
+    static void latency_callback(jack_latency_callback_mode_t mode, void *arg);
+    static void timebase_callback(jack_transport_state_t state, jack_nframes_t size,
+                                  jack_position_t *pos, int new_pos, void *arg);
 };
 
 //=============================================================================
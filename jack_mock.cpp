@@ -0,0 +1,547 @@
+#include "jack_mock.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <algorithm>
+
+namespace Jack {
+
+//=============================================================================
+
+MockBackend::Buffer::Buffer() {
+    nframes = 0;
+    lost = 0;
+    events.reserve(MaxBufferEvents);
+}
+
+MockBackend::MockClient::MockClient() {
+    active = false;
+    process = NULL;
+    process_arg = NULL;
+    sample_rate = NULL;
+    sample_rate_arg = NULL;
+    sync = NULL;
+    sync_arg = NULL;
+    latency = NULL;
+    latency_arg = NULL;
+    xrun = NULL;
+    xrun_arg = NULL;
+    freewheel = NULL;
+    freewheel_arg = NULL;
+    shutdown = NULL;
+    shutdown_arg = NULL;
+}
+
+//=============================================================================
+
+MockBackend::MockBackend(NFrames sample_rate, NFrames period_size) {
+    assert(sample_rate > 0);
+    assert(period_size > 0);
+    this->sample_rate = sample_rate;
+    this->period_size = period_size;
+    frame_time = 0;
+    freewheeling = false;
+    transport_state = JackTransportStopped;
+    memset(&transport_position, 0, sizeof(transport_position));
+    transport_moved = true;
+    timebase_client = NULL;
+    timebase = NULL;
+    timebase_arg = NULL;
+}
+
+MockBackend::~MockBackend() {
+    // clients that were never closed
+    while (!clients.empty()) {
+        client_close((jack_client_t *)clients.back());
+    }
+}
+
+void MockBackend::set_sample_rate(NFrames sample_rate) {
+    assert(sample_rate > 0);
+    this->sample_rate = sample_rate;
+    for (MockClientArray::iterator i = clients.begin(); i != clients.end(); ++i) {
+        if ((*i)->sample_rate)
+            (*i)->sample_rate(sample_rate, (*i)->sample_rate_arg);
+    }
+}
+
+NFrames MockBackend::get_sample_rate() const {
+    return sample_rate;
+}
+
+void MockBackend::set_period_size(NFrames period_size) {
+    assert(period_size > 0);
+    this->period_size = period_size;
+}
+
+NFrames MockBackend::get_period_size() const {
+    return period_size;
+}
+
+long long MockBackend::get_frame_time() const {
+    return frame_time;
+}
+
+bool MockBackend::process(int periods) {
+    for (int i = 0; i < periods; ++i) {
+        bool any_active = false;
+        for (MockClientArray::iterator c = clients.begin(); c != clients.end(); ++c) {
+            if ((*c)->active)
+                any_active = true;
+        }
+        if (!any_active)
+            return false;
+        process_period();
+    }
+    return true;
+}
+
+bool MockBackend::process_samples(long long samples) {
+    if (samples <= 0)
+        return true;
+    return process((int)((samples + period_size - 1) / period_size));
+}
+
+void MockBackend::update_transport() {
+    // the timebase master fills in the position first, so
+    // sync callbacks already see bar, beat and tick.
+    if (timebase && ((transport_state == JackTransportRolling) || transport_moved)) {
+        transport_position.valid = (jack_position_bits_t)0;
+        timebase(transport_state, period_size, &transport_position,
+            transport_moved?1:0, timebase_arg);
+    }
+    if ((transport_state == JackTransportStarting) || transport_moved) {
+        bool ready = true;
+        for (MockClientArray::iterator i = clients.begin(); i != clients.end(); ++i) {
+            if (!(*i)->active || !(*i)->sync)
+                continue;
+            if (!(*i)->sync(transport_state, &transport_position, (*i)->sync_arg))
+                ready = false;
+        }
+        if ((transport_state == JackTransportStarting) && ready)
+            transport_state = JackTransportRolling;
+    }
+    transport_moved = false;
+}
+
+void MockBackend::process_period() {
+    transport_position.frame_rate = sample_rate;
+    transport_position.usecs = get_time();
+    update_transport();
+
+    long long period_end = frame_time + period_size;
+
+    // deliver due input and reset all buffers to the new size
+    for (MockClientArray::iterator c = clients.begin(); c != clients.end(); ++c) {
+        for (MockPortArray::iterator p = (*c)->ports.begin(); p != (*c)->ports.end(); ++p) {
+            MockPort *port = *p;
+            port->buffer.nframes = period_size;
+            if (!(port->flags & JackPortIsInput))
+                continue;
+            midi_clear_buffer(&port->buffer);
+            EventArray::iterator e = port->input.begin();
+            for (; e != port->input.end(); ++e) {
+                if (e->time >= period_end)
+                    break;
+                NFrames offset = 0;
+                if (e->time > frame_time)
+                    offset = (NFrames)(e->time - frame_time);
+                midi_event_write(&port->buffer, offset, &e->data[0], e->data.size());
+            }
+            port->input.erase(port->input.begin(), e);
+        }
+    }
+
+    for (MockClientArray::iterator c = clients.begin(); c != clients.end(); ++c) {
+        if ((*c)->active && (*c)->process)
+            (*c)->process(period_size, (*c)->process_arg);
+    }
+
+    // whatever is left in an output buffer goes out, just as
+    // with a server, where buffers are not cleared for a client.
+    for (MockClientArray::iterator c = clients.begin(); c != clients.end(); ++c) {
+        for (MockPortArray::iterator p = (*c)->ports.begin(); p != (*c)->ports.end(); ++p) {
+            MockPort *port = *p;
+            if (!(port->flags & JackPortIsOutput))
+                continue;
+            std::vector<BufferEvent> &events = port->buffer.events;
+            for (size_t i = 0; i < events.size(); ++i) {
+                Event event;
+                event.time = frame_time + events[i].time;
+                event.data = events[i].data;
+                port->output.push_back(event);
+            }
+        }
+    }
+
+    frame_time = period_end;
+    if (transport_state == JackTransportRolling)
+        transport_position.frame += period_size;
+}
+
+MockBackend::MockPort *MockBackend::find_port(const std::string &name) {
+    for (MockClientArray::iterator c = clients.begin(); c != clients.end(); ++c) {
+        for (MockPortArray::iterator p = (*c)->ports.begin(); p != (*c)->ports.end(); ++p) {
+            if (((*p)->name == name) || (((*c)->name + ":" + (*p)->name) == name))
+                return *p;
+        }
+    }
+    return NULL;
+}
+
+void MockBackend::inject_event(const std::string &port, long long time,
+                               const jack_midi_data_t *data, size_t size) {
+    MockPort *mock_port = find_port(port);
+    if (!mock_port) {
+        fprintf(stderr, "MockBackend: no such port: %s\n", port.c_str());
+        return;
+    }
+    assert(data && size);
+    Event event;
+    event.time = time;
+    event.data.assign(data, data + size);
+    // keep the queue sorted, events with the same time stay in order
+    EventArray::iterator i = mock_port->input.end();
+    while ((i != mock_port->input.begin()) && ((i-1)->time > time))
+        --i;
+    mock_port->input.insert(i, event);
+}
+
+void MockBackend::inject_event(const std::string &port, long long time,
+                               const MIDI::Message &msg) {
+    inject_event(port, time, msg.bytes, msg.get_size());
+}
+
+const MockBackend::EventArray &MockBackend::get_output(const std::string &port) {
+    static EventArray empty;
+    MockPort *mock_port = find_port(port);
+    if (!mock_port) {
+        fprintf(stderr, "MockBackend: no such port: %s\n", port.c_str());
+        return empty;
+    }
+    return mock_port->output;
+}
+
+void MockBackend::clear_output() {
+    for (MockClientArray::iterator c = clients.begin(); c != clients.end(); ++c) {
+        for (MockPortArray::iterator p = (*c)->ports.begin(); p != (*c)->ports.end(); ++p) {
+            (*p)->output.clear();
+        }
+    }
+}
+
+void MockBackend::xrun() {
+    for (MockClientArray::iterator i = clients.begin(); i != clients.end(); ++i) {
+        if ((*i)->active && (*i)->xrun)
+            (*i)->xrun((*i)->xrun_arg);
+    }
+}
+
+void MockBackend::shutdown_server() {
+    for (MockClientArray::iterator i = clients.begin(); i != clients.end(); ++i) {
+        (*i)->active = false;
+        if ((*i)->shutdown)
+            (*i)->shutdown((*i)->shutdown_arg);
+    }
+}
+
+void MockBackend::set_port_latency(const std::string &port, NFrames latency) {
+    MockPort *mock_port = find_port(port);
+    if (!mock_port) {
+        fprintf(stderr, "MockBackend: no such port: %s\n", port.c_str());
+        return;
+    }
+    mock_port->latency.min = latency;
+    mock_port->latency.max = latency;
+    for (MockClientArray::iterator i = clients.begin(); i != clients.end(); ++i) {
+        if ((*i)->latency)
+            (*i)->latency(JackPlaybackLatency, (*i)->latency_arg);
+    }
+}
+
+bool MockBackend::is_freewheeling() const {
+    return freewheeling;
+}
+
+jack_transport_state_t MockBackend::get_transport_state() const {
+    return transport_state;
+}
+
+jack_nframes_t MockBackend::get_transport_frame() const {
+    return transport_position.frame;
+}
+
+//=============================================================================
+
+bool MockBackend::runs_process_thread() const {
+    return false;
+}
+
+jack_client_t *MockBackend::client_open(const char *name, jack_status_t *status) {
+    MockClient *client = new MockClient();
+    client->name = name;
+    clients.push_back(client);
+    if (status)
+        *status = (jack_status_t)0;
+    return (jack_client_t *)client;
+}
+
+int MockBackend::client_close(jack_client_t *client) {
+    MockClient *mock_client = (MockClient *)client;
+    MockClientArray::iterator i = std::find(clients.begin(), clients.end(), mock_client);
+    if (i == clients.end())
+        return -1;
+    if (timebase_client == mock_client)
+        release_timebase(client);
+    for (MockPortArray::iterator p = mock_client->ports.begin();
+         p != mock_client->ports.end(); ++p) {
+        delete *p;
+    }
+    clients.erase(i);
+    delete mock_client;
+    return 0;
+}
+
+int MockBackend::activate(jack_client_t *client) {
+    ((MockClient *)client)->active = true;
+    return 0;
+}
+
+int MockBackend::deactivate(jack_client_t *client) {
+    ((MockClient *)client)->active = false;
+    return 0;
+}
+
+int MockBackend::set_process_callback(jack_client_t *client,
+    JackProcessCallback callback, void *arg) {
+    MockClient *mock_client = (MockClient *)client;
+    mock_client->process = callback;
+    mock_client->process_arg = arg;
+    return 0;
+}
+
+int MockBackend::set_sample_rate_callback(jack_client_t *client,
+    JackSampleRateCallback callback, void *arg) {
+    MockClient *mock_client = (MockClient *)client;
+    mock_client->sample_rate = callback;
+    mock_client->sample_rate_arg = arg;
+    // the server reports the current rate right away
+    if (callback)
+        callback(sample_rate, arg);
+    return 0;
+}
+
+int MockBackend::set_sync_callback(jack_client_t *client,
+    JackSyncCallback callback, void *arg) {
+    MockClient *mock_client = (MockClient *)client;
+    mock_client->sync = callback;
+    mock_client->sync_arg = arg;
+    return 0;
+}
+
+int MockBackend::set_latency_callback(jack_client_t *client,
+    JackLatencyCallback callback, void *arg) {
+    MockClient *mock_client = (MockClient *)client;
+    mock_client->latency = callback;
+    mock_client->latency_arg = arg;
+    return 0;
+}
+
+int MockBackend::set_xrun_callback(jack_client_t *client,
+    JackXRunCallback callback, void *arg) {
+    MockClient *mock_client = (MockClient *)client;
+    mock_client->xrun = callback;
+    mock_client->xrun_arg = arg;
+    return 0;
+}
+
+int MockBackend::set_freewheel_callback(jack_client_t *client,
+    JackFreewheelCallback callback, void *arg) {
+    MockClient *mock_client = (MockClient *)client;
+    mock_client->freewheel = callback;
+    mock_client->freewheel_arg = arg;
+    return 0;
+}
+
+void MockBackend::on_shutdown(jack_client_t *client,
+    JackShutdownCallback callback, void *arg) {
+    MockClient *mock_client = (MockClient *)client;
+    mock_client->shutdown = callback;
+    mock_client->shutdown_arg = arg;
+}
+
+jack_transport_state_t MockBackend::transport_query(jack_client_t *client,
+    jack_position_t *pos) {
+    if (pos) {
+        *pos = transport_position;
+        pos->frame_rate = sample_rate;
+        pos->usecs = get_time();
+    }
+    return transport_state;
+}
+
+int MockBackend::transport_locate(jack_client_t *client, jack_nframes_t frame) {
+    transport_position.frame = frame;
+    transport_moved = true;
+    // a rolling transport has to wait for slow clients again
+    if (transport_state == JackTransportRolling)
+        transport_state = JackTransportStarting;
+    return 0;
+}
+
+void MockBackend::transport_start(jack_client_t *client) {
+    if (transport_state == JackTransportStopped)
+        transport_state = JackTransportStarting;
+}
+
+void MockBackend::transport_stop(jack_client_t *client) {
+    transport_state = JackTransportStopped;
+}
+
+int MockBackend::set_timebase_callback(jack_client_t *client, int conditional,
+    JackTimebaseCallback callback, void *arg) {
+    MockClient *mock_client = (MockClient *)client;
+    if (conditional && timebase_client && (timebase_client != mock_client))
+        return EBUSY;
+    timebase_client = mock_client;
+    timebase = callback;
+    timebase_arg = arg;
+    transport_moved = true;
+    return 0;
+}
+
+int MockBackend::release_timebase(jack_client_t *client) {
+    if (timebase_client != (MockClient *)client)
+        return EINVAL;
+    timebase_client = NULL;
+    timebase = NULL;
+    timebase_arg = NULL;
+    return 0;
+}
+
+int MockBackend::set_freewheel(jack_client_t *client, int onoff) {
+    bool enable = (onoff != 0);
+    if (enable == freewheeling)
+        return 0;
+    freewheeling = enable;
+    for (MockClientArray::iterator i = clients.begin(); i != clients.end(); ++i) {
+        if ((*i)->freewheel)
+            (*i)->freewheel(onoff, (*i)->freewheel_arg);
+    }
+    return 0;
+}
+
+jack_time_t MockBackend::get_time() {
+    // the clock only moves with processed periods
+    return (jack_time_t)(frame_time * 1000000 / sample_rate);
+}
+
+jack_port_t *MockBackend::port_register(jack_client_t *client, const char *name,
+    const char *type, unsigned long flags, unsigned long buffer_size) {
+    MockClient *mock_client = (MockClient *)client;
+    MockPort *port = new MockPort();
+    port->name = name;
+    port->flags = flags;
+    port->buffer.nframes = period_size;
+    port->latency.min = 0;
+    port->latency.max = 0;
+    mock_client->ports.push_back(port);
+    return (jack_port_t *)port;
+}
+
+int MockBackend::port_unregister(jack_client_t *client, jack_port_t *port) {
+    MockClient *mock_client = (MockClient *)client;
+    MockPort *mock_port = (MockPort *)port;
+    MockPortArray::iterator i = std::find(mock_client->ports.begin(),
+        mock_client->ports.end(), mock_port);
+    if (i == mock_client->ports.end())
+        return -1;
+    mock_client->ports.erase(i);
+    delete mock_port;
+    return 0;
+}
+
+void *MockBackend::port_get_buffer(jack_port_t *port, jack_nframes_t nframes) {
+    MockPort *mock_port = (MockPort *)port;
+    assert(nframes == mock_port->buffer.nframes);
+    return &mock_port->buffer;
+}
+
+void MockBackend::port_get_latency_range(jack_port_t *port,
+    jack_latency_callback_mode_t mode, jack_latency_range_t *range) {
+    MockPort *mock_port = (MockPort *)port;
+    // input latency is not simulated
+    if (mode == JackPlaybackLatency) {
+        *range = mock_port->latency;
+    } else {
+        range->min = 0;
+        range->max = 0;
+    }
+}
+
+jack_nframes_t MockBackend::midi_get_event_count(void *buffer) {
+    return (jack_nframes_t)((Buffer *)buffer)->events.size();
+}
+
+int MockBackend::midi_event_get(jack_midi_event_t *event, void *buffer,
+    uint32_t index) {
+    Buffer *mock_buffer = (Buffer *)buffer;
+    if (index >= mock_buffer->events.size())
+        return ENODATA;
+    BufferEvent &buffer_event = mock_buffer->events[index];
+    event->time = buffer_event.time;
+    event->size = buffer_event.data.size();
+    event->buffer = &buffer_event.data[0];
+    return 0;
+}
+
+void MockBackend::midi_clear_buffer(void *buffer) {
+    Buffer *mock_buffer = (Buffer *)buffer;
+    mock_buffer->events.clear();
+    mock_buffer->lost = 0;
+}
+
+size_t MockBackend::midi_max_event_size(void *buffer) {
+    Buffer *mock_buffer = (Buffer *)buffer;
+    if (mock_buffer->events.size() >= MaxBufferEvents)
+        return 0;
+    // no byte limit, messages here are a few bytes at most
+    return 256;
+}
+
+int MockBackend::midi_event_write(void *buffer, jack_nframes_t time,
+    const jack_midi_data_t *data, size_t size) {
+    jack_midi_data_t *target = midi_event_reserve(buffer, time, size);
+    if (!target)
+        return ENOBUFS;
+    memcpy(target, data, size);
+    return 0;
+}
+
+jack_midi_data_t *MockBackend::midi_event_reserve(void *buffer,
+    jack_nframes_t time, size_t size) {
+    Buffer *mock_buffer = (Buffer *)buffer;
+    // the same rules as the server: in time order, within
+    // the period and while there is room.
+    if ((time >= mock_buffer->nframes)
+        || (!mock_buffer->events.empty() && (time < mock_buffer->events.back().time))
+        || (size == 0) || (size > midi_max_event_size(buffer))) {
+        mock_buffer->lost++;
+        return NULL;
+    }
+    mock_buffer->events.push_back(BufferEvent());
+    BufferEvent &buffer_event = mock_buffer->events.back();
+    buffer_event.time = time;
+    buffer_event.data.resize(size);
+    return &buffer_event.data[0];
+}
+
+uint32_t MockBackend::midi_get_lost_event_count(void *buffer) {
+    return ((Buffer *)buffer)->lost;
+}
+
+//=============================================================================
+
+} // namespace Jack
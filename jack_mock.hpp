@@ -0,0 +1,189 @@
+#pragma once
+
+#include "jack.hpp"
+
+#include <string>
+#include <vector>
+
+namespace Jack {
+
+//=============================================================================
+
+// runs clients without a JACK server. nothing happens on its own:
+// process() calls the process callbacks for one period and advances
+// a virtual clock, so output can be checked to the sample and far
+// faster than realtime. the transport, freewheel mode, xruns and
+// port latencies are simulated as well.
+class MockBackend : public Backend {
+public:
+    enum {
+        // how many events fit into a port buffer per period
+        MaxBufferEvents = 1024,
+    };
+
+    struct Event {
+        // absolute time in samples
+        long long time;
+        std::vector<jack_midi_data_t> data;
+    };
+    typedef std::vector<Event> EventArray;
+
+    MockBackend(NFrames sample_rate=48000, NFrames period_size=256);
+    virtual ~MockBackend();
+
+    // the sample rate callbacks are called right away, the period
+    // size applies from the next period on.
+    void set_sample_rate(NFrames sample_rate);
+    NFrames get_sample_rate() const;
+    void set_period_size(NFrames period_size);
+    NFrames get_period_size() const;
+
+    // runs periods, returns false if there was no active client
+    bool process(int periods=1);
+    // runs as many periods as it takes to cover samples
+    bool process_samples(long long samples);
+    // samples processed so far
+    long long get_frame_time() const;
+
+    // queues an event for an input port at an absolute time in
+    // samples. events that are due already go out at the start
+    // of the next period. port is either "client:port" or "port".
+    void inject_event(const std::string &port, long long time,
+                      const jack_midi_data_t *data, size_t size);
+    void inject_event(const std::string &port, long long time,
+                      const MIDI::Message &msg);
+    // events written to an output port since the last clear,
+    // in the order they were delivered
+    const EventArray &get_output(const std::string &port);
+    void clear_output();
+
+    // simulated server events
+    void xrun();
+    void shutdown_server();
+    void set_port_latency(const std::string &port, NFrames latency);
+    bool is_freewheeling() const;
+    jack_transport_state_t get_transport_state() const;
+    jack_nframes_t get_transport_frame() const;
+
+    // Backend
+    virtual bool runs_process_thread() const;
+
+    virtual jack_client_t *client_open(const char *name, jack_status_t *status);
+    virtual int client_close(jack_client_t *client);
+    virtual int activate(jack_client_t *client);
+    virtual int deactivate(jack_client_t *client);
+
+    virtual int set_process_callback(jack_client_t *client,
+        JackProcessCallback callback, void *arg);
+    virtual int set_sample_rate_callback(jack_client_t *client,
+        JackSampleRateCallback callback, void *arg);
+    virtual int set_sync_callback(jack_client_t *client,
+        JackSyncCallback callback, void *arg);
+    virtual int set_latency_callback(jack_client_t *client,
+        JackLatencyCallback callback, void *arg);
+    virtual int set_xrun_callback(jack_client_t *client,
+        JackXRunCallback callback, void *arg);
+    virtual int set_freewheel_callback(jack_client_t *client,
+        JackFreewheelCallback callback, void *arg);
+    virtual void on_shutdown(jack_client_t *client,
+        JackShutdownCallback callback, void *arg);
+
+    virtual jack_transport_state_t transport_query(jack_client_t *client,
+        jack_position_t *pos);
+    virtual int transport_locate(jack_client_t *client, jack_nframes_t frame);
+    virtual void transport_start(jack_client_t *client);
+    virtual void transport_stop(jack_client_t *client);
+    virtual int set_timebase_callback(jack_client_t *client, int conditional,
+        JackTimebaseCallback callback, void *arg);
+    virtual int release_timebase(jack_client_t *client);
+    virtual int set_freewheel(jack_client_t *client, int onoff);
+    virtual jack_time_t get_time();
+
+    virtual jack_port_t *port_register(jack_client_t *client, const char *name,
+        const char *type, unsigned long flags, unsigned long buffer_size);
+    virtual int port_unregister(jack_client_t *client, jack_port_t *port);
+    virtual void *port_get_buffer(jack_port_t *port, jack_nframes_t nframes);
+    virtual void port_get_latency_range(jack_port_t *port,
+        jack_latency_callback_mode_t mode, jack_latency_range_t *range);
+
+    virtual jack_nframes_t midi_get_event_count(void *buffer);
+    virtual int midi_event_get(jack_midi_event_t *event, void *buffer,
+        uint32_t index);
+    virtual void midi_clear_buffer(void *buffer);
+    virtual size_t midi_max_event_size(void *buffer);
+    virtual int midi_event_write(void *buffer, jack_nframes_t time,
+        const jack_midi_data_t *data, size_t size);
+    virtual jack_midi_data_t *midi_event_reserve(void *buffer,
+        jack_nframes_t time, size_t size);
+    virtual uint32_t midi_get_lost_event_count(void *buffer);
+
+protected:
+    struct BufferEvent {
+        NFrames time;
+        std::vector<jack_midi_data_t> data;
+    };
+
+    struct Buffer {
+        NFrames nframes;
+        std::vector<BufferEvent> events;
+        uint32_t lost;
+
+        Buffer();
+    };
+
+    struct MockPort {
+        std::string name;
+        unsigned long flags;
+        Buffer buffer;
+        jack_latency_range_t latency;
+        // input waiting to be delivered, sorted by time
+        EventArray input;
+        EventArray output;
+    };
+    typedef std::vector<MockPort *> MockPortArray;
+
+    struct MockClient {
+        std::string name;
+        bool active;
+        MockPortArray ports;
+        JackProcessCallback process;
+        void *process_arg;
+        JackSampleRateCallback sample_rate;
+        void *sample_rate_arg;
+        JackSyncCallback sync;
+        void *sync_arg;
+        JackLatencyCallback latency;
+        void *latency_arg;
+        JackXRunCallback xrun;
+        void *xrun_arg;
+        JackFreewheelCallback freewheel;
+        void *freewheel_arg;
+        JackShutdownCallback shutdown;
+        void *shutdown_arg;
+
+        MockClient();
+    };
+    typedef std::vector<MockClient *> MockClientArray;
+
+    MockPort *find_port(const std::string &name);
+    void update_transport();
+    void process_period();
+
+    NFrames sample_rate;
+    NFrames period_size;
+    long long frame_time;
+    bool freewheeling;
+    MockClientArray clients;
+
+    jack_transport_state_t transport_state;
+    jack_position_t transport_position;
+    // the position changed since the last period
+    bool transport_moved;
+    MockClient *timebase_client;
+    JackTimebaseCallback timebase;
+    void *timebase_arg;
+};
+
+//=============================================================================
+
+} // namespace Jack
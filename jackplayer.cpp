@@ -0,0 +1,495 @@
+#include "jackplayer.hpp"
+#include "model.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <stdio.h>
+#include <algorithm>
+
+namespace Jacker {
+
+//=============================================================================
+
+JackPlayer::JackPlayer(Jack::Backend *backend) : Jack::Client("jacker", backend) {
+    thread_messages.resize(100);
+    
+    enable_clock_sync = false;
+    process_samples = 0;
+    bouncing = false;
+    bounce_cancel = false;
+    bounce_end = 0;
+    enable_sync = false;
+    waiting_for_sync = false;
+    defunct = false;
+    midi_inp = new Jack::MIDIPort(
+        *this, "control", Jack::MIDIPort::IsInput);
+    midi_omni_out = new Jack::MIDIPort(
+        *this, "omni", Jack::MIDIPort::IsOutput);
+    for (int i = 0; i < MaxPorts; ++i) {
+        char name[32];
+        sprintf(name, "port-%i", i);
+        Jack::MIDIPort *port = new Jack::MIDIPort(
+            *this, name, Jack::MIDIPort::IsOutput);
+        // registered on demand, see update_ports()
+        set_port_enabled(*port, false);
+        midi_ports.push_back(port);
+    }
+}
+
+JackPlayer::~JackPlayer() {
+    for (size_t i = 0; i < midi_ports.size(); ++i) {
+        delete midi_ports[i];
+    }
+    midi_ports.clear();
+    delete midi_omni_out;
+    delete midi_inp;
+}
+
+void JackPlayer::play() {
+    if (enable_sync) {
+        transport_start();
+        return;
+    }
+    Player::play();
+}
+
+void JackPlayer::seek(int frame) {
+    if (enable_sync) {
+        transport_locate(get_position_from_frame(frame));
+        return;
+    }
+    Player::seek(frame);
+}
+
+void JackPlayer::stop() {
+    if (enable_sync) {
+        transport_stop();
+        return;
+    }
+    Player::stop();
+}
+
+void JackPlayer::update_ports() {
+    std::vector<bool> used(midi_ports.size(), false);
+    for (size_t i = 0; i < model->tracks.size(); ++i) {
+        int port = model->tracks[i].midi_port;
+        if ((port >= 0) && (port < (int)used.size()))
+            used[port] = true;
+    }
+    int control_port = model->midi_control_port;
+    if ((control_port >= 0) && (control_port < (int)used.size()))
+        used[control_port] = true;
+    int clock_port = get_clock_port();
+    if ((clock_port >= 0) && (clock_port < (int)used.size()))
+        used[clock_port] = true;
+    for (size_t i = 0; i < midi_ports.size(); ++i) {
+        set_port_enabled(*midi_ports[i], used[i]);
+    }
+}
+
+void JackPlayer::update_latency() {
+    if (bouncing)
+        return; // the process thread mixes
+    if (latency_changed()) {
+        for (size_t i = 0; i < midi_ports.size(); ++i) {
+            set_port_latency((int)i, 
+                (int)midi_ports[i]->get_playback_latency());
+        }
+    }
+    Player::update_latency();
+}
+
+void JackPlayer::write_port_event(int port, Jack::NFrames offset, 
+                                  const MIDI::Message &msg) {
+    if ((port < 0) || (port >= (int)midi_ports.size()))
+        return;
+    Jack::MIDIPort *midi_port = midi_ports[port];
+    if (midi_port->is_enabled())
+        midi_port->queue_event(offset, msg);
+}
+
+void JackPlayer::handle_thread_message(ThreadMessage &msg) {
+    switch(msg.type) {
+        case MsgPlay : {
+            printf("SYNC: play\n");
+            Player::play();
+        } break;
+        case MsgStop : {
+            printf("SYNC: stop\n");
+            Player::stop();
+        } break;
+        case MsgSeek : {
+            printf("SYNC: seek to %i\n", msg.position);
+            Player::seek(msg.position, msg.delay);
+        } break;
+        case MsgClockSync : {
+            if (!enable_clock_sync)
+                break;
+            int fpb = model->frames_per_beat;
+            if (clock_follower.is_locked()) {
+                set_frame_size(clock_follower.get_frame_size(fpb));
+                model->beats_per_minute = std::max(1,
+                    (int)(clock_follower.get_beats_per_minute() + 0.5));
+            }
+            Player::seek(clock_follower.get_frame(fpb));
+        } break;
+        default: break;
+    }
+}
+
+void JackPlayer::process_thread_messages() {
+    ThreadMessage msg;
+    while (!thread_messages.empty()) {
+        msg = thread_messages.peek();
+        if (!bouncing)
+            handle_thread_message(msg);
+        thread_messages.pop();
+    }
+}
+
+void JackPlayer::mix() {
+    process_thread_messages();
+    if (bouncing)
+        return; // the process thread mixes and seeks
+    Player::mix();
+    update_checkpoints();
+}
+
+void JackPlayer::start_bounce(int begin, int end) {
+    Player::stop();
+    Player::seek(begin);
+    bounce_end = end;
+    bounce_cancel = false;
+    bouncing = true;
+    if (enable_sync) {
+        transport_locate(get_position_from_frame(begin));
+        transport_start();
+    }
+    set_freewheel(true);
+}
+
+void JackPlayer::cancel_bounce() {
+    bounce_cancel = true;
+}
+
+void JackPlayer::finish_bounce() {
+    // what came in during the bounce is stale now
+    while (!thread_messages.empty())
+        thread_messages.pop();
+    set_freewheel(false);
+    if (enable_sync)
+        transport_stop();
+}
+
+bool JackPlayer::is_bouncing() const {
+    return bouncing;
+}
+
+void JackPlayer::process_bounce() {
+    if (!bounce_cancel) {
+        if (!is_freewheeling())
+            return; // wait until freewheel mode is on
+        if (!is_playing() && !start_cued())
+            return;
+        if (get_position() < bounce_end) {
+            Player::mix();
+            return;
+        }
+    }
+    Player::stop();
+    bouncing = false;
+}
+
+void JackPlayer::on_sample_rate(Jack::NFrames nframes) {
+    set_sample_rate((int)nframes);
+    clock_follower.set_sample_rate((int)nframes);
+    reset();
+}
+
+void JackPlayer::set_clock_sync(bool enable) {
+    enable_clock_sync = enable;
+    if (!enable) {
+        clock_follower.stop();
+        set_frame_size(0);
+    }
+}
+
+void JackPlayer::push_thread_message(ThreadMessageType type, int position, 
+                                     long long delay) {
+    if (thread_messages.full())
+        return;
+    ThreadMessage msg;
+    msg.type = type;
+    msg.position = position;
+    msg.delay = delay;
+    thread_messages.push(msg);
+}
+
+bool JackPlayer::on_clock_message(Jack::NFrames time, const MIDI::Message &msg) {
+    if (!enable_clock_sync)
+        return false;
+    switch(msg.status) {
+        case MIDI::StatusTimingClock: {
+            clock_follower.tick(process_samples + time);
+            // check for drift once per beat
+            if (clock_follower.is_running() && clock_follower.is_locked() &&
+                !(clock_follower.get_position() % ClockFollower::TicksPerBeat)) {
+                int fpb = model->frames_per_beat;
+                int frame_delta = clock_follower.get_frame(fpb) - get_position();
+                long long frame_size = get_frame_size();
+                long long size_delta = 
+                    clock_follower.get_frame_size(fpb) - frame_size;
+                if (size_delta < 0)
+                    size_delta = -size_delta;
+                if ((frame_delta < -1) || (frame_delta > 1) || 
+                    (size_delta > (frame_size / 1000))) {
+                    if (thread_messages.empty())
+                        push_thread_message(MsgClockSync);
+                }
+            }
+        } break;
+        case MIDI::StatusStart: {
+            clock_follower.start();
+            push_thread_message(MsgClockSync);
+            push_thread_message(MsgPlay);
+        } break;
+        case MIDI::StatusContinue: {
+            clock_follower.resume();
+            push_thread_message(MsgClockSync);
+            push_thread_message(MsgPlay);
+        } break;
+        case MIDI::StatusStop: {
+            clock_follower.stop();
+            push_thread_message(MsgStop);
+        } break;
+        case MIDI::StatusSongPosition: {
+            clock_follower.set_song_position(msg.data1 | (msg.data2 << 7));
+            if (!clock_follower.is_running())
+                push_thread_message(MsgClockSync);
+        } break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+void JackPlayer::on_message(const Message &msg) {
+    //printf("msg: CH%i 0x%x %i %i\n", msg.channel+1, msg.command, msg.data1, msg.data2);
+    int offset = std::max(msg.timestamp>>8, 0);
+    stats.add_events(1);
+    // system messages only go to their port
+    if (msg.status < MIDI::StatusSysEx)
+        midi_omni_out->queue_event(offset, msg);
+    write_port_event(msg.port, offset, msg);
+}
+
+bool JackPlayer::can_send(const Message &msg) {
+    if (msg.type == Message::TypeEmpty)
+        return true;
+    if (midi_omni_out->get_queue_room() <= ReservedEvents)
+        return false;
+    if ((msg.port < 0) || (msg.port >= (int)midi_ports.size()))
+        return true;
+    return midi_ports[msg.port]->get_queue_room() > ReservedEvents;
+}
+
+void JackPlayer::discard_messages() {
+    midi_omni_out->discard_events();
+    for (size_t i = 0; i < midi_ports.size(); ++i) {
+        midi_ports[i]->discard_events();
+    }
+}
+
+void JackPlayer::get_frame_from_position(const Jack::Position &pos, 
+                                         int &frame, long long &delay) {
+    long long frame_size = get_frame_size();
+    if (!is_timebase_master() && (pos.valid & JackPositionBBT) &&
+        (pos.ticks_per_beat > 0.0)) {
+        // the timebase master knows better where we are
+        int fpb = model->frames_per_beat;
+        long long beat = (long long)(pos.bar - 1) * 
+            (long long)(pos.beats_per_bar + 0.5) + (pos.beat - 1);
+        double ticks = (double)pos.tick * fpb / pos.ticks_per_beat;
+        int tick_frame = (int)ceil(ticks);
+        frame = (int)(beat * fpb) + tick_frame;
+        delay = (long long)(((double)tick_frame - ticks) * frame_size);
+        if (pos.valid & JackBBTFrameOffset) {
+            // the BBT fields are that many samples old
+            delay -= (long long)pos.bbt_offset << 32;
+            while (delay < 0) {
+                delay += frame_size;
+                frame++;
+            }
+        }
+    } else {
+        long long samples = (long long)pos.frame << 32;
+        long long result = (samples + frame_size - 1) / frame_size;
+        frame = (int)result;
+        delay = result * frame_size - samples;
+    }
+}
+
+Jack::NFrames JackPlayer::get_position_from_frame(int frame) {
+    return (Jack::NFrames)(((long long)frame * get_frame_size()) >> 32);
+}
+
+bool JackPlayer::cue_transport(const Jack::Position &pos) {
+    int frame;
+    long long delay;
+    get_frame_from_position(pos, frame, delay);
+    if (is_cued(frame, delay))
+        return true;
+    if (waiting_for_sync && !thread_messages.empty())
+        return false; // already asked for it
+    push_thread_message(MsgSeek, frame, delay);
+    waiting_for_sync = true;
+    return false;
+}
+
+bool JackPlayer::on_sync(Jack::TransportState state, const Jack::Position &pos) {
+    if (!enable_sync) {
+        waiting_for_sync = false;
+        return true;
+    }
+    
+    switch(state) {
+        case JackTransportStopped:
+        {
+            if (is_playing()) {
+                if (thread_messages.empty())
+                    push_thread_message(MsgStop);
+                return true;
+            }
+            if (cue_transport(pos))
+                waiting_for_sync = false;
+            return true;
+        } break;
+        case JackTransportStarting:
+        {
+            if (is_playing()) {
+                // relocated while rolling
+                if (thread_messages.empty())
+                    push_thread_message(MsgStop);
+                return false;
+            }
+            if (cue_transport(pos)) {
+                waiting_for_sync = false;
+                return true;
+            }
+            return false;
+        } break;
+        default: break;
+    }
+    return true;
+}
+
+void JackPlayer::on_timebase(Jack::TransportState state, Jack::NFrames size,
+                             Jack::Position &pos, bool new_pos) {
+    int fpb = model->frames_per_beat;
+    int bpb = model->beats_per_bar;
+    long long frame_size = get_frame_size();
+    // position in frames, with the fraction in the lower 32 bits
+    long long samples = (long long)pos.frame << 32;
+    long long frame = samples / frame_size;
+    long long frac = ((samples - frame * frame_size) << 16) / frame_size;
+    long long beat = frame / fpb;
+    pos.valid = (jack_position_bits_t)(pos.valid | JackPositionBBT);
+    pos.beats_per_bar = (float)bpb;
+    pos.beat_type = 4.0f;
+    pos.ticks_per_beat = TimebaseTicksPerBeat;
+    pos.beats_per_minute = 
+        (double)sample_rate * 60.0 * 4294967296.0 / ((double)frame_size * fpb);
+    pos.bar = (int)(beat / bpb) + 1;
+    pos.beat = (int)(beat % bpb) + 1;
+    pos.tick = (int)((((frame % fpb) << 16) + frac) * TimebaseTicksPerBeat / 
+        ((long long)fpb << 16));
+    pos.bar_start_tick = (double)(pos.bar - 1) * bpb * TimebaseTicksPerBeat;
+}
+
+void JackPlayer::set_timebase_master(bool enable) {
+    if (!is_created())
+        return;
+    Jack::Client::set_timebase_master(enable);
+}
+
+void JackPlayer::on_process(Jack::NFrames size) {
+    if (enable_sync) {
+        Jack::Position tpos;
+        memset(&tpos, 0, sizeof(tpos));
+        Jack::TransportState tstate = transport_query(&tpos);
+        switch(tstate) {
+            case JackTransportRolling: {
+                if (is_playing()) {
+                    waiting_for_sync = false;
+                    break;
+                }
+                // the premix was prepared while starting
+                int frame;
+                long long delay;
+                get_frame_from_position(tpos, frame, delay);
+                if (is_cued(frame, delay) && start_cued())
+                    break;
+                if (!waiting_for_sync) {
+                    push_thread_message(MsgSeek, frame, delay);
+                    push_thread_message(MsgPlay);
+                    waiting_for_sync = true;
+                }
+            } break;
+            case JackTransportStopped: {
+                if (is_playing() && thread_messages.empty()) {
+                    push_thread_message(MsgStop);
+                }
+            } break;
+            default:
+                break;
+        }
+    }
+    
+    for (Jack::NFrames i = 0; i < midi_inp->get_event_count(); ++i) {
+        MIDI::Message ctrl_msg;
+        Jack::NFrames time;
+        if (midi_inp->get_event(ctrl_msg, &time, i)) {
+            if (on_clock_message(time, ctrl_msg))
+                continue;
+            record_message((int)time, ctrl_msg);
+            ctrl_msg.channel = model->midi_control_channel;
+            midi_omni_out->queue_event(0, ctrl_msg);
+            write_port_event(model->midi_control_port, 0, ctrl_msg);
+        }
+    }
+
+    if (bouncing)
+        process_bounce();
+    process_messages((int)size);
+    process_samples += size;
+    if (is_playing())
+        stats.set_queue_status(get_queue_fill(), get_premix_ahead());
+}
+
+void JackPlayer::on_shutdown() {
+    defunct = true;
+    // no process callback is going to finish it
+    bouncing = false;
+}
+
+void JackPlayer::print_port_stats(Jack::MIDIPort *port, const char *name) {
+    unsigned int lost = port->get_lost_count();
+    unsigned int overflow = port->get_overflow_count();
+    if (!lost && !overflow)
+        return;
+    printf("%s: %u events lost, %u events overflowed\n", 
+        name, lost, overflow);
+}
+
+void JackPlayer::print_port_stats() {
+    print_port_stats(midi_omni_out, "omni");
+    for (size_t i = 0; i < midi_ports.size(); ++i) {
+        char name[32];
+        sprintf(name, "port-%i", (int)i);
+        print_port_stats(midi_ports[i], name);
+    }
+}
+
+//=============================================================================
+
+} // namespace Jacker
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "jack.hpp"
+#include "player.hpp"
+#include "ring_buffer.hpp"
+
+#include <vector>
+
+namespace Jacker {
+
+//=============================================================================
+
+// plays the player through a JACK client: the premix goes out on
+// one output port per track port and the omni port, the control
+// input is passed through or recorded, and the transport and midi
+// clock are followed if enabled.
+class JackPlayer : public Jack::Client,
+                   public Player {
+public:
+    enum ThreadMessageType {
+        MsgPlay = 0,
+        MsgStop = 1,
+        MsgSeek = 2,
+        // align position and tempo with the clock follower
+        MsgClockSync = 3,
+    };
+
+    enum {
+        // port queue room kept free for the note offs of a bus
+        ReservedEvents = 128,
+        // resolution of the BBT position published as timebase master
+        TimebaseTicksPerBeat = 1920,
+    };
+
+    struct ThreadMessage {
+        ThreadMessageType type;
+        int position;
+        // time until position begins, in 32.32 samples
+        long long delay;
+    };
+
+    RingBuffer<ThreadMessage> thread_messages;
+
+    Jack::MIDIPort *midi_inp;
+    Jack::MIDIPort *midi_omni_out;
+    typedef std::vector<Jack::MIDIPort *> MIDIPortArray;
+
+    MIDIPortArray midi_ports;
+    bool defunct;
+
+    volatile bool enable_sync;
+    volatile bool waiting_for_sync;
+
+    // follow midi clock on the control input
+    volatile bool enable_clock_sync;
+    ClockFollower clock_follower;
+    // samples processed so far
+    long long process_samples;
+
+    // offline bounce in freewheel mode, see start_bounce()
+    volatile bool bouncing;
+    volatile bool bounce_cancel;
+    volatile int bounce_end;
+
+    // runs on libjack unless another backend is passed
+    JackPlayer(Jack::Backend *backend=NULL);
+    ~JackPlayer();
+
+    void play();
+    void seek(int frame);
+    void stop();
+
+    // registers the ports used by tracks and releases the others
+    void update_ports();
+    // picks up port latencies after the graph changed
+    void update_latency();
+
+    void write_port_event(int port, Jack::NFrames offset,
+                          const MIDI::Message &msg);
+
+    void handle_thread_message(ThreadMessage &msg);
+    // runs the messages from the process thread. while bouncing,
+    // the process thread owns the player and moves the transport
+    // itself, so they are dropped.
+    void process_thread_messages();
+
+    void mix();
+
+    // plays frames [begin, end) in freewheel mode. the process
+    // callback mixes on its own then, as the 100 ms mix timer
+    // could not keep up. the song must not change until
+    // is_bouncing() returns false.
+    void start_bounce(int begin, int end);
+    void cancel_bounce();
+    // leaves freewheel mode after the bounce finished
+    void finish_bounce();
+    bool is_bouncing() const;
+    // called from the process callback while bouncing
+    void process_bounce();
+
+    virtual void on_sample_rate(Jack::NFrames nframes);
+
+    void set_clock_sync(bool enable);
+
+    void push_thread_message(ThreadMessageType type, int position=0,
+                             long long delay=0);
+
+    // handles realtime messages on the control input while
+    // following the clock. returns false if msg is not one.
+    bool on_clock_message(Jack::NFrames time, const MIDI::Message &msg);
+
+    virtual void on_message(const Message &msg);
+    virtual bool can_send(const Message &msg);
+    virtual void discard_messages();
+
+    // maps a transport position to the first frame at or after it,
+    // and the time until that frame begins in 32.32 samples.
+    void get_frame_from_position(const Jack::Position &pos,
+                                 int &frame, long long &delay);
+    // inverse of get_frame_from_position, rounded down so
+    // the frame maps back to itself.
+    Jack::NFrames get_position_from_frame(int frame);
+    // makes sure the premix starts at the transport position.
+    // returns true if it does.
+    bool cue_transport(const Jack::Position &pos);
+
+    virtual bool on_sync(Jack::TransportState state, const Jack::Position &pos);
+    // publishes our tempo and meter as timebase master
+    virtual void on_timebase(Jack::TransportState state, Jack::NFrames size,
+                             Jack::Position &pos, bool new_pos);
+    void set_timebase_master(bool enable);
+
+    virtual void on_process(Jack::NFrames size);
+    virtual void on_shutdown();
+
+    void print_port_stats(Jack::MIDIPort *port, const char *name);
+    void print_port_stats();
+};
+
+//=============================================================================
+
+} // namespace Jacker
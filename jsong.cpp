@@ -1,8 +1,11 @@
 
 #include "jsong.hpp"
+#include "parallel.hpp"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
 
 namespace Jacker {
 
@@ -14,6 +17,67 @@ enum {
 
 //=============================================================================
 
+// used to find out what changed since the last journal write
+static unsigned int get_checksum(const Pattern &pattern) {
+    unsigned int hash = 2166136261u;
+    hash = hash_value(hash, pattern.name);
+    return hash_value(hash, (int)pattern.get_hash());
+}
+
+//=============================================================================
+
+// (event count, index) pairs, sorted so the largest patterns
+// are handed out to the workers first.
+typedef std::vector< std::pair<int,int> > WorkOrder;
+
+static void sort_work_order(WorkOrder &order) {
+    std::sort(order.begin(), order.end());
+    std::reverse(order.begin(), order.end());
+}
+
+struct JSongCollectTask {
+    JSongWriter *writer;
+    std::vector<Pattern *> patterns;
+    std::vector<Json::Value> values;
+    WorkOrder order;
+};
+
+static void collect_pattern(int index, void *data) {
+    JSongCollectTask *task = (JSongCollectTask *)data;
+    int i = task->order[index].second;
+    task->writer->collect(task->values[i], *task->patterns[i]);
+}
+
+struct JSongBuildTask {
+    JSongReader *reader;
+    const Json::Value *patterns;
+    WorkOrder order;
+};
+
+static void build_pattern(int index, void *data) {
+    JSongBuildTask *task = (JSongBuildTask *)data;
+    int i = task->order[index].second;
+    task->reader->build((*task->patterns)[i], *task->reader->patterns[i]);
+}
+
+// builds every pattern the reader has an entry for. patterns are
+// independent, so they can be built in parallel.
+static void build_patterns(JSongReader &reader, const Json::Value &patterns) {
+    JSongBuildTask task;
+    task.reader = &reader;
+    task.patterns = &patterns;
+    for (size_t i = 0; i < reader.patterns.size(); ++i) {
+        if (!reader.patterns[i])
+            continue;
+        task.order.push_back(std::make_pair(
+            (int)patterns[(int)i]["events"].size(), (int)i));
+    }
+    sort_work_order(task.order);
+    parallel_for((int)task.order.size(), &build_pattern, &task);
+}
+
+//=============================================================================
+
 void JSongWriter::collect(Json::Value &root, PatternEvent &event) {
     root["frame"] = event.frame;
     root["channel"] = event.channel;
@@ -22,6 +86,7 @@ void JSongWriter::collect(Json::Value &root, PatternEvent &event) {
 }
 
 void JSongWriter::collect(Json::Value &root, Pattern &pattern) {
+    pattern.load();
     root["name"] = pattern.name;
     root["length"] = pattern.get_length();
     root["channel_count"] = pattern.get_channel_count();
@@ -48,6 +113,8 @@ void JSongWriter::collect(Json::Value &root, Song::Event &event) {
     root["frame"] = event.frame;
     root["track"] = event.track;
     root["pattern"] = iter->second;
+    if (event.length != ValueNone)
+        root["length"] = event.length;
 }
 
 void JSongWriter::collect(Json::Value &root, Song &song) {
@@ -75,12 +142,32 @@ void JSongWriter::collect(Json::Value &root, Track &track) {
     root["midi_channel"] = track.midi_channel;
     root["midi_port"] = track.midi_port;
     root["mute"] = track.mute;
+    if (track.solo)
+        root["solo"] = track.solo;
     root["name"] = track.name;
+    if (track.latency)
+        root["latency"] = track.latency;
+    if (!track.groove.empty()) {
+        Json::Value groove;
+        for (size_t i = 0; i < track.groove.size(); ++i) {
+            groove.append(track.groove[i]);
+        }
+        root["groove"] = groove;
+    }
 }
 
-void JSongWriter::collect(Json::Value &root, Model &model) {
-    root["format"] = "jacker-song";
-    root["version"] = JSongVersion;
+void JSongWriter::collect(Json::Value &root, TrackArray &tracks) {
+    for (TrackArray::iterator iter = tracks.begin();
+         iter != tracks.end(); ++iter) {
+        Json::Value track;
+        collect(track, *iter);
+        if (!track.empty()) {
+            root.append(track);
+        }
+    }
+}
+
+void JSongWriter::collect_settings(Json::Value &root, Model &model) {
     root["end_cue"] = model.end_cue;
     root["frames_per_beat"] = model.frames_per_beat;
     root["beats_per_bar"] = model.beats_per_bar;
@@ -93,35 +180,71 @@ void JSongWriter::collect(Json::Value &root, Model &model) {
         root["loop"] = loop;
     }
     
-    Json::Value tracks;
-    for (TrackArray::iterator iter = model.tracks.begin();
-         iter != model.tracks.end(); ++iter) {
-        Json::Value track;
-        collect(track, *iter);
-        if (!track.empty()) {
-            tracks.append(track);
-        }
+    if (model.enable_playlist)
+        root["enable_playlist"] = model.enable_playlist;
+    Json::Value regions;
+    for (size_t i = 0; i < model.regions.size(); ++i) {
+        const Region &region = model.regions[i];
+        Json::Value value;
+        value["name"] = region.name;
+        value["begin"] = region.begin;
+        value["end"] = region.end;
+        regions.append(value);
     }
+    if (!regions.empty()) {
+        root["regions"] = regions;
+    }
+    Json::Value playlist;
+    for (size_t i = 0; i < model.playlist.size(); ++i) {
+        const PlaylistEntry &entry = model.playlist[i];
+        Json::Value value;
+        value["region"] = entry.region;
+        value["repeat"] = entry.repeat;
+        playlist.append(value);
+    }
+    if (!playlist.empty()) {
+        root["playlist"] = playlist;
+    }
+}
+
+void JSongWriter::collect(Json::Value &root, Model &model) {
+    root["format"] = "jacker-song";
+    root["version"] = JSongVersion;
+    collect_settings(root, model);
+    
+    Json::Value tracks;
+    collect(tracks, model.tracks);
     if (!tracks.empty()) {
         root["tracks"] = tracks;
     }
     
+    // the loader is not thread safe, so decode pending patterns first
+    model.load_patterns();
+    
+    // patterns are independent, so they can be collected in parallel
+    JSongCollectTask task;
+    task.writer = this;
+    task.patterns.assign(model.patterns.begin(), model.patterns.end());
+    task.values.resize(task.patterns.size());
+    for (size_t i = 0; i < task.patterns.size(); ++i) {
+        task.order.push_back(std::make_pair((int)task.patterns[i]->size(), (int)i));
+    }
+    sort_work_order(task.order);
+    parallel_for((int)task.order.size(), &collect_pattern, &task);
+    
     Json::Value patterns;
     
     int index = 0;
-    for (PatternList::iterator iter = model.patterns.begin(); 
-         iter != model.patterns.end(); ++iter) {
-        Json::Value pattern;
-        collect(pattern, *(*iter));
-        if (!pattern.empty()) {
-            patterns.append(pattern);
-            pattern2id.insert(Pattern2IdMap::value_type(*iter,index));
+    for (size_t i = 0; i < task.patterns.size(); ++i) {
+        if (!task.values[i].empty()) {
+            patterns.append(Json::Value()).swap(task.values[i]);
+            pattern2id.insert(Pattern2IdMap::value_type(task.patterns[i],index));
             index++;
         }
     }
     
     if (!patterns.empty()) {
-        root["patterns"] = patterns;
+        root["patterns"].swap(patterns);
     }
     
     Json::Value song;
@@ -141,6 +264,59 @@ void JSongWriter::write(Json::Value &root, const std::string &filepath) {
 
 //=============================================================================
 
+void JSongPatternLoader::load(Pattern &pattern) {
+    Pattern2IdMap::iterator iter = pattern2id.find(&pattern);
+    if (iter == pattern2id.end())
+        return;
+    Json::Value &value = root["patterns"][iter->second];
+    JSongReader reader;
+    reader.build(value, pattern);
+    // free memory, we don't need it anymore
+    value = Json::Value();
+    pattern2id.erase(iter);
+    checksums[&pattern] = get_checksum(pattern);
+}
+
+void JSongPatternLoader::load_all(PatternList &patterns) {
+    const Json::Value &values = root["patterns"];
+    JSongReader reader;
+    reader.patterns.resize(values.size(), NULL);
+    for (PatternList::iterator iter = patterns.begin(); 
+         iter != patterns.end(); ++iter) {
+        Pattern2IdMap::iterator id = pattern2id.find(*iter);
+        if (id == pattern2id.end())
+            continue;
+        // detach first, so building the pattern doesn't load it again
+        (*iter)->set_loader(NULL);
+        reader.patterns[id->second] = *iter;
+    }
+    build_patterns(reader, values);
+    for (size_t i = 0; i < reader.patterns.size(); ++i) {
+        Pattern *pattern = reader.patterns[i];
+        if (!pattern)
+            continue;
+        // free memory, we don't need it anymore
+        root["patterns"][(int)i] = Json::Value();
+        pattern2id.erase(pattern);
+        checksums[pattern] = get_checksum(*pattern);
+    }
+}
+
+void JSongPatternLoader::forget(Pattern *pattern) {
+    Pattern2IdMap::iterator iter = pattern2id.find(pattern);
+    if (iter != pattern2id.end()) {
+        root["patterns"][iter->second] = Json::Value();
+        pattern2id.erase(iter);
+    }
+    checksums.erase(pattern);
+}
+
+//=============================================================================
+
+JSongReader::JSongReader() {
+    loader = NULL;
+}
+
 bool JSongReader::extract(const Json::Value &value, std::string &target) {
     if (!value.isString())
         return false;
@@ -169,7 +345,7 @@ void JSongReader::build(const Json::Value &root, Pattern::Event &event) {
     extract(root["value"], event.value);        
 }
 
-void JSongReader::build(const Json::Value &root, Pattern &pattern) {
+void JSongReader::build_header(const Json::Value &root, Pattern &pattern) {
     extract(root["name"], pattern.name);
     int length = 64;
     if (extract(root["length"], length))
@@ -177,15 +353,17 @@ void JSongReader::build(const Json::Value &root, Pattern &pattern) {
     int channel_count = 1;
     if (extract(root["channel_count"], channel_count))
         pattern.set_channel_count(channel_count);
+}
+
+void JSongReader::build(const Json::Value &root, Pattern &pattern) {
+    build_header(root, pattern);
     
-    const Json::Value events = root["events"];
+    const Json::Value &events = root["events"];
     for (size_t i = 0; i < events.size(); ++i) {
         Pattern::Event event;
         build(events[i], event);
         pattern.add_event(event);
     }
-    
-    patterns.push_back(&pattern);
 }
 
 bool JSongReader::build(const Json::Value &root, Song::Event &event) {
@@ -197,6 +375,11 @@ bool JSongReader::build(const Json::Value &root, Song::Event &event) {
     if ((pattern_index < 0)||(pattern_index >= (int)patterns.size()))
         return false;
     event.pattern = patterns[pattern_index];
+    if (!event.pattern)
+        return false;
+    int length = ValueNone;
+    if (extract(root["length"], length) && (length > 0))
+        event.set_length(length);
     return true;
 }
 
@@ -221,11 +404,29 @@ void JSongReader::build(const Json::Value &root, Track &track) {
     extract(root["midi_channel"], track.midi_channel);
     extract(root["midi_port"], track.midi_port);
     extract(root["mute"], track.mute);
+    extract(root["solo"], track.solo);
     extract(root["name"], track.name);
+    extract(root["latency"], track.latency);
+    const Json::Value groove = root["groove"];
+    track.groove.clear();
+    for (size_t i = 0; i < groove.size(); ++i) {
+        int delay = 0;
+        extract(groove[i], delay);
+        track.groove.push_back(std::min(std::max(delay, 0), 0xff));
+    }
 }
 
-void JSongReader::build(const Json::Value &root, Model &model) {
-    model.reset();
+void JSongReader::build(const Json::Value &root, TrackArray &tracks) {
+    if (!root.empty())
+        tracks.clear();
+    for (size_t i = 0; i < root.size(); ++i) {
+        Track track;
+        build(root[i], track);
+        tracks.push_back(track);
+    }
+}
+
+void JSongReader::build_settings(const Json::Value &root, Model &model) {
     extract(root["end_cue"], model.end_cue);
     extract(root["frames_per_beat"], model.frames_per_beat);
     extract(root["beats_per_bar"], model.beats_per_bar);
@@ -237,19 +438,46 @@ void JSongReader::build(const Json::Value &root, Model &model) {
         build(loop, model.loop);
     }
     
-    const Json::Value tracks = root["tracks"];
-    if (!tracks.empty())
-        model.tracks.clear();
-    for (size_t i = 0; i < tracks.size(); ++i) {
-        Track track;
-        build(tracks[i], track);
-        model.tracks.push_back(track);
+    extract(root["enable_playlist"], model.enable_playlist);
+    const Json::Value regions = root["regions"];
+    model.regions.clear();
+    for (size_t i = 0; i < regions.size(); ++i) {
+        Region region;
+        extract(regions[i]["name"], region.name);
+        extract(regions[i]["begin"], region.begin);
+        extract(regions[i]["end"], region.end);
+        model.regions.push_back(region);
     }
+    const Json::Value playlist = root["playlist"];
+    model.playlist.clear();
+    for (size_t i = 0; i < playlist.size(); ++i) {
+        PlaylistEntry entry;
+        extract(playlist[i]["region"], entry.region);
+        extract(playlist[i]["repeat"], entry.repeat);
+        model.playlist.push_back(entry);
+    }
+}
+
+void JSongReader::build(const Json::Value &root, Model &model) {
+    model.reset();
+    build_settings(root, model);
+    build(root["tracks"], model.tracks);
     
-    const Json::Value patterns = root["patterns"];
+    const Json::Value &patterns = root["patterns"];
     for (size_t i = 0; i < patterns.size(); ++i) {
         Pattern &pattern = model.new_pattern();
-        build(patterns[i], pattern);
+        if (loader) {
+            build_header(patterns[i], pattern);
+            loader->pattern2id.insert(
+                JSongPatternLoader::Pattern2IdMap::value_type(&pattern, i));
+            pattern.set_loader(loader);
+        }
+        this->patterns.push_back(&pattern);
+    }
+    if (loader) {
+        model.set_pattern_loader(loader);
+    } else {
+        build_patterns(*this, patterns);
     }
     
     const Json::Value song = root["song"];
@@ -271,8 +499,336 @@ bool JSongReader::read(Json::Value &root, const std::string &filepath) {
 
 //=============================================================================
 
-bool read_jsong(Model &model, const std::string &filepath) {
+JSongJournal::PatternState::PatternState() {
+    id = -1;
+    known = false;
+    checksum = 0;
+}
+
+JSongJournal::JSongJournal() {
+    model = NULL;
+    song_checksum = 0;
+    tracks_checksum = 0;
+    settings_checksum = 0;
+    size = 0;
+}
+
+JSongJournal::~JSongJournal() {
+    close();
+}
+
+std::string JSongJournal::get_path(const std::string &filepath) {
+    return filepath + ".journal";
+}
+
+long JSongJournal::get_size() const {
+    return size;
+}
+
+unsigned int JSongJournal::get_song_checksum(Model &model) {
+    unsigned int hash = 2166136261u;
+    for (Song::iterator iter = model.song.begin(); 
+         iter != model.song.end(); ++iter) {
+        hash = hash_value(hash, iter->second.frame);
+        hash = hash_value(hash, iter->second.track);
+        hash = hash_value(hash, states[iter->second.pattern].id);
+        hash = hash_value(hash, iter->second.length);
+    }
+    return hash;
+}
+
+unsigned int JSongJournal::get_tracks_checksum(Model &model) {
+    unsigned int hash = 2166136261u;
+    for (TrackArray::iterator iter = model.tracks.begin();
+         iter != model.tracks.end(); ++iter) {
+        hash = hash_value(hash, iter->name);
+        hash = hash_value(hash, iter->midi_port);
+        hash = hash_value(hash, iter->midi_channel);
+        hash = hash_value(hash, iter->mute);
+        hash = hash_value(hash, iter->solo);
+        hash = hash_value(hash, iter->latency);
+        hash = hash_value(hash, (int)iter->groove.size());
+        for (size_t i = 0; i < iter->groove.size(); ++i) {
+            hash = hash_value(hash, iter->groove[i]);
+        }
+    }
+    return hash;
+}
+
+unsigned int JSongJournal::get_settings_checksum(Model &model) {
+    unsigned int hash = 2166136261u;
+    hash = hash_value(hash, model.end_cue);
+    hash = hash_value(hash, model.frames_per_beat);
+    hash = hash_value(hash, model.beats_per_bar);
+    hash = hash_value(hash, model.beats_per_minute);
+    hash = hash_value(hash, model.enable_loop);
+    hash = hash_value(hash, model.loop.get_begin());
+    hash = hash_value(hash, model.loop.get_end());
+    hash = hash_value(hash, model.enable_playlist);
+    hash = hash_value(hash, (int)model.regions.size());
+    for (RegionArray::iterator iter = model.regions.begin();
+         iter != model.regions.end(); ++iter) {
+        hash = hash_value(hash, iter->name);
+        hash = hash_value(hash, iter->begin);
+        hash = hash_value(hash, iter->end);
+    }
+    hash = hash_value(hash, (int)model.playlist.size());
+    for (Playlist::iterator iter = model.playlist.begin();
+         iter != model.playlist.end(); ++iter) {
+        hash = hash_value(hash, iter->region);
+        hash = hash_value(hash, iter->repeat);
+    }
+    return hash;
+}
+
+void JSongJournal::observe(Model *model) {
+    if (this->model == model)
+        return;
+    if (this->model) {
+        std::vector<PatternObserver *> &observers = 
+            this->model->pattern_observers;
+        observers.erase(std::remove(observers.begin(), observers.end(),
+            (PatternObserver *)this), observers.end());
+    }
+    this->model = model;
+    if (model)
+        model->pattern_observers.push_back(this);
+}
+
+void JSongJournal::init(Model &model) {
+    observe(&model);
+    // ids are assigned in the same order JSongWriter uses
+    states.clear();
+    id2pattern.clear();
+    for (PatternList::iterator iter = model.patterns.begin(); 
+         iter != model.patterns.end(); ++iter) {
+        PatternState state;
+        state.id = (int)id2pattern.size();
+        if ((*iter)->is_loaded()) {
+            state.known = true;
+            state.checksum = get_checksum(*(*iter));
+        }
+        states[*iter] = state;
+        id2pattern.push_back(*iter);
+    }
+    song_checksum = get_song_checksum(model);
+    tracks_checksum = get_tracks_checksum(model);
+    settings_checksum = get_settings_checksum(model);
+}
+
+bool JSongJournal::apply(Model &model, const Json::Value &record) {
     JSongReader reader;
+    std::string type;
+    if (!reader.extract(record["type"], type))
+        return false;
+    if (type == "pattern") {
+        int id = -1;
+        if (!reader.extract(record["id"], id) || (id < 0))
+            return false;
+        if (id >= (int)id2pattern.size())
+            id2pattern.resize(id+1, NULL);
+        Pattern *pattern = id2pattern[id];
+        if (!pattern) {
+            pattern = &model.new_pattern();
+            id2pattern[id] = pattern;
+        }
+        // replace all contents, the file version must not be
+        // decoded into the pattern later
+        JSongPatternLoader *loader = 
+            dynamic_cast<JSongPatternLoader *>(model.pattern_loader);
+        if (loader)
+            loader->forget(pattern);
+        pattern->set_loader(NULL);
+        pattern->clear();
+        reader.build(record["pattern"], *pattern);
+        PatternState &state = states[pattern];
+        state.id = id;
+        state.known = true;
+        state.checksum = get_checksum(*pattern);
+    } else if (type == "song") {
+        reader.patterns = id2pattern;
+        model.song.clear();
+        reader.build(record["song"], model.song);
+        model.update_pattern_refcount();
+    } else if (type == "tracks") {
+        reader.build(record["tracks"], model.tracks);
+    } else if (type == "settings") {
+        reader.build_settings(record["settings"], model);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int JSongJournal::open(Model &model, const std::string &filepath) {
+    this->filepath = filepath;
+    init(model);
+    size = 0;
+    
+    std::ifstream inp(get_path(filepath).c_str());
+    if (!inp)
+        return 0;
+    
+    int count = 0;
+    std::string line;
+    while (std::getline(inp, line)) {
+        Json::Reader reader;
+        Json::Value record;
+        // a damaged record ends the journal, the rest can't be trusted
+        if (!reader.parse(line, record, false))
+            break;
+        if (!apply(model, record))
+            break;
+        size += (long)line.size() + 1;
+        count++;
+    }
+    inp.close();
+    
+    if (count) {
+        model.delete_unused_patterns();
+        song_checksum = get_song_checksum(model);
+        tracks_checksum = get_tracks_checksum(model);
+        settings_checksum = get_settings_checksum(model);
+    }
+    return count;
+}
+
+void JSongJournal::reset(Model &model, const std::string &filepath) {
+    this->filepath = filepath;
+    init(model);
+    size = 0;
+    std::remove(get_path(filepath).c_str());
+}
+
+void JSongJournal::close() {
+    observe(NULL);
+    filepath.clear();
+    states.clear();
+    id2pattern.clear();
+    size = 0;
+}
+
+void JSongJournal::forget(Pattern *pattern) {
+    states.erase(pattern);
+    // ids are not reused, so older records stay unambiguous
+    for (size_t i = 0; i < id2pattern.size(); ++i) {
+        if (id2pattern[i] == pattern)
+            id2pattern[i] = NULL;
+    }
+}
+
+int JSongJournal::write(Model &model) {
+    if (filepath.empty())
+        return 0;
+    
+    JSongWriter writer;
+    Json::FastWriter fast_writer;
+    std::string text;
+    int count = 0;
+    
+    PatternStateMap new_states;
+    JSongPatternLoader *loader = 
+        dynamic_cast<JSongPatternLoader *>(model.pattern_loader);
+    for (PatternList::iterator iter = model.patterns.begin(); 
+         iter != model.patterns.end(); ++iter) {
+        Pattern &pattern = *(*iter);
+        PatternState state;
+        PatternStateMap::iterator found = states.find(&pattern);
+        if (found != states.end()) {
+            state = found->second;
+        } else {
+            state.id = (int)id2pattern.size();
+            id2pattern.push_back(&pattern);
+        }
+        if (!pattern.is_loaded()) {
+            // can't have changed
+            new_states[&pattern] = state;
+            continue;
+        }
+        if (!state.known && loader) {
+            JSongPatternLoader::ChecksumMap::iterator checksum =
+                loader->checksums.find(&pattern);
+            if (checksum != loader->checksums.end()) {
+                state.known = true;
+                state.checksum = checksum->second;
+            }
+        }
+        unsigned int pattern_checksum = get_checksum(pattern);
+        if (!state.known || (state.checksum != pattern_checksum)) {
+            Json::Value record;
+            record["type"] = "pattern";
+            record["id"] = state.id;
+            writer.collect(record["pattern"], pattern);
+            text += fast_writer.write(record);
+            count++;
+            state.known = true;
+            state.checksum = pattern_checksum;
+        }
+        new_states[&pattern] = state;
+    }
+    states.swap(new_states);
+    
+    unsigned int new_checksum = get_song_checksum(model);
+    if (new_checksum != song_checksum) {
+        for (PatternStateMap::iterator iter = states.begin();
+             iter != states.end(); ++iter) {
+            writer.pattern2id[iter->first] = iter->second.id;
+        }
+        Json::Value record;
+        record["type"] = "song";
+        writer.collect(record["song"], model.song);
+        text += fast_writer.write(record);
+        count++;
+        song_checksum = new_checksum;
+    }
+    
+    new_checksum = get_tracks_checksum(model);
+    if (new_checksum != tracks_checksum) {
+        Json::Value record;
+        record["type"] = "tracks";
+        writer.collect(record["tracks"], model.tracks);
+        text += fast_writer.write(record);
+        count++;
+        tracks_checksum = new_checksum;
+    }
+    
+    new_checksum = get_settings_checksum(model);
+    if (new_checksum != settings_checksum) {
+        Json::Value record;
+        record["type"] = "settings";
+        writer.collect_settings(record["settings"], model);
+        text += fast_writer.write(record);
+        count++;
+        settings_checksum = new_checksum;
+    }
+    
+    if (!count)
+        return 0;
+    
+    std::ofstream out(get_path(filepath).c_str(), 
+        std::ios::out | std::ios::app);
+    if (!out)
+        return 0;
+    out << text;
+    out.close();
+    size += (long)text.size();
+    return count;
+}
+
+//=============================================================================
+
+bool read_jsong(Model &model, const std::string &filepath, bool lazy) {
+    JSongReader reader;
+    if (lazy) {
+        // the loader keeps the document
+        reader.loader = new JSongPatternLoader();
+        if (!reader.read(reader.loader->root, filepath)) {
+            delete reader.loader;
+            return false;
+        }
+        reader.build(reader.loader->root,model);
+        return true;
+    }
     Json::Value root;
     if (!reader.read(root, filepath))
         return false;
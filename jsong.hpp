@@ -18,6 +18,8 @@ public:
     void collect(Json::Value &root, Song &song);
     void collect(Json::Value &root, Loop &loop);
     void collect(Json::Value &root, Track &track);
+    void collect(Json::Value &root, TrackArray &tracks);
+    void collect_settings(Json::Value &root, Model &model);
     void collect(Json::Value &root, Model &model);
 
     void write(Json::Value &root, const std::string &filepath);    
@@ -25,21 +27,50 @@ public:
 
 //=============================================================================
 
+class JSongPatternLoader : public PatternLoader {
+public:
+    typedef std::map<Pattern *, int> Pattern2IdMap;
+    typedef std::map<Pattern *, unsigned int> ChecksumMap;
+    Pattern2IdMap pattern2id;
+    // checksums of decoded patterns as they were in the file
+    ChecksumMap checksums;
+    
+    // the parsed document, pattern sections are
+    // released as soon as they have been decoded
+    Json::Value root;
+    
+    virtual void load(Pattern &pattern);
+    // decodes the pending patterns in parallel
+    virtual void load_all(PatternList &patterns);
+    // drops the file contents of a pattern, called when
+    // its contents are replaced or it is deleted
+    virtual void forget(Pattern *pattern);
+};
+
+//=============================================================================
+
 class JSongReader {
 public:
     // so we can resolve by index
     std::vector<Pattern *> patterns;
+    // if set, pattern events are decoded on first access
+    JSongPatternLoader *loader;
+    
+    JSongReader();
 
     bool extract(const Json::Value &value, std::string &target);
     bool extract(const Json::Value &value, int &target);
     bool extract(const Json::Value &value, bool &target);
 
     void build(const Json::Value &root, Pattern::Event &event);    
+    void build_header(const Json::Value &root, Pattern &pattern);
     void build(const Json::Value &root, Pattern &pattern);    
     bool build(const Json::Value &root, Song::Event &event);    
     void build(const Json::Value &root, Song &song);
     void build(const Json::Value &root, Loop &loop);    
     void build(const Json::Value &root, Track &track);
+    void build(const Json::Value &root, TrackArray &tracks);
+    void build_settings(const Json::Value &root, Model &model);
     void build(const Json::Value &root, Model &model);
 
     bool read(Json::Value &root, const std::string &filepath);
@@ -47,8 +78,73 @@ public:
 
 //=============================================================================
 
+// append-only log of the changes made since a song was written.
+// each line of the journal is one record, which either replaces a pattern,
+// the song events, the tracks or the settings. patterns are identified
+// by their index in the song file; new patterns get the following ids.
+class JSongJournal : public PatternObserver {
+public:
+    JSongJournal();
+    ~JSongJournal();
+    
+    static std::string get_path(const std::string &filepath);
+    
+    // call after a song file has been read; applies
+    // the journal for that file and returns the number
+    // of applied records.
+    int open(Model &model, const std::string &filepath);
+    // call after a song file has been written; discards the journal.
+    void reset(Model &model, const std::string &filepath);
+    // forget about the current file.
+    void close();
+    // drops the state of a pattern that is about to be deleted
+    virtual void forget(Pattern *pattern);
+    
+    // appends records for all changes since the last call
+    // and returns the number of records written.
+    int write(Model &model);
+    
+    // size of the journal in bytes
+    long get_size() const;
+    
+protected:
+    struct PatternState {
+        int id;
+        // false if the pattern has not been decoded since it was written
+        bool known;
+        unsigned int checksum;
+        
+        PatternState();
+    };
+    
+    typedef std::map<Pattern *, PatternState> PatternStateMap;
+    
+    // registers as pattern observer of model, or none if NULL
+    void observe(Model *model);
+    void init(Model &model);
+    bool apply(Model &model, const Json::Value &record);
+    unsigned int get_song_checksum(Model &model);
+    unsigned int get_tracks_checksum(Model &model);
+    unsigned int get_settings_checksum(Model &model);
+    
+    // observed while a file is open
+    Model *model;
+    std::string filepath;
+    PatternStateMap states;
+    // resolves ids on replay
+    std::vector<Pattern *> id2pattern;
+    unsigned int song_checksum;
+    unsigned int tracks_checksum;
+    unsigned int settings_checksum;
+    long size;
+};
+
+//=============================================================================
+
 void write_jsong(Model &model, const std::string &filepath);
-bool read_jsong(Model &model, const std::string &filepath);
+// if lazy is true, pattern events are only decoded when
+// the pattern is accessed for the first time.
+bool read_jsong(Model &model, const std::string &filepath, bool lazy=false);
     
 //=============================================================================
 
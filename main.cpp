@@ -6,8 +6,11 @@
 #include <gtkmm/accelmap.h>
 #include <glibmm/optioncontext.h>
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
 #include <stdio.h>
 #include <iostream>
+#include <sstream>
 #include <string>
 
 #include "model.hpp"
@@ -16,6 +19,8 @@
 #include "measure.hpp"
 #include "trackview.hpp"
 #include "player.hpp"
+#include "jackplayer.hpp"
+#include "recorder.hpp"
 
 #include "jsong.hpp"
 #include "ring_buffer.hpp"
@@ -31,227 +36,18 @@ const char AccelPathTrackView[] = "<Jacker>/View/Song";
 const char AccelPathSave[] = "<Jacker>/File/Save";
 const char AccelPathOpen[] = "<Jacker>/File/Open";
 
-class JackPlayer : public Jack::Client,
-                   public Player {
-public:
-    enum ThreadMessageType {
-        MsgPlay = 0,
-        MsgStop = 1,
-        MsgSeek = 2,
-    };
-        
-    struct ThreadMessage {
-        ThreadMessageType type;
-        int position;
-    };
-    
-    RingBuffer<ThreadMessage> thread_messages;
-   
-    Jack::MIDIPort *midi_inp;
-    Jack::MIDIPort *midi_omni_out;
-    typedef std::vector<Jack::MIDIPort *> MIDIPortArray;
-
-    MIDIPortArray midi_ports;
-    bool defunct;
-
-    bool enable_sync;
-    bool waiting_for_sync;
-
-    JackPlayer() : Jack::Client("jacker") {
-        thread_messages.resize(100);
-        
-        enable_sync = false;
-        waiting_for_sync = false;
-        defunct = false;
-        midi_inp = new Jack::MIDIPort(
-            *this, "control", Jack::MIDIPort::IsInput);
-        midi_omni_out = new Jack::MIDIPort(
-            *this, "omni", Jack::MIDIPort::IsOutput);
-        for (int i = 0; i < MaxPorts; ++i) {
-            char name[32];
-            sprintf(name, "port-%i", i);
-            midi_ports.push_back(new Jack::MIDIPort(
-                *this, name, Jack::MIDIPort::IsOutput));
-        }
-    }
-    
-    ~JackPlayer() {
-        for (size_t i = 0; i < midi_ports.size(); ++i) {
-            delete midi_ports[i];
-        }
-        midi_ports.clear();
-        delete midi_omni_out;
-        delete midi_inp;
-    }
-    
-    void play() {
-        if (enable_sync) {
-            transport_start();
-            return;
-        }
-        Player::play();
-    }
-    
-    void seek(int frame) {
-        if (enable_sync) {
-            double samples = 
-                (double)frame * (sample_rate * 60.0) / (double)(model->beats_per_minute * model->frames_per_beat);
-            transport_locate((int)(samples+0.5));
-            return;
-        }
-        Player::seek(frame);
-    }
-    
-    void stop() {
-        if (enable_sync) {
-            transport_stop();
-            return;
-        }
-        Player::stop();
-    }
-    
-    void handle_thread_message(ThreadMessage &msg) {
-        switch(msg.type) {
-            case MsgPlay : {
-                printf("SYNC: play\n");
-                Player::play();
-            } break;
-            case MsgStop : {
-                printf("SYNC: stop\n");
-                Player::stop();
-            } break;
-            case MsgSeek : {
-                printf("SYNC: seek to %i\n", msg.position);
-                Player::seek(msg.position);
-            } break;
-            default: break;
-        }
-    }
-    
-    void mix() {
-        ThreadMessage msg;
-        while (!thread_messages.empty()) {
-            msg = thread_messages.peek();
-            handle_thread_message(msg);
-            thread_messages.pop();
-        }
-
-        Player::mix();
-    }
-    
-    virtual void on_sample_rate(Jack::NFrames nframes) {
-        set_sample_rate((int)nframes);
-        reset();
-    }
-    
-    virtual void on_message(const Message &msg) {
-        //printf("msg: CH%i 0x%x %i %i\n", msg.channel+1, msg.command, msg.data1, msg.data2);
-        int offset = (int)(msg.timestamp>>32L);
-        midi_omni_out->write_event(offset, msg);
-        midi_ports[msg.port]->write_event(offset, msg);
-    }
-    
-    int get_frame_from_position(const Jack::Position &pos) {
-        /*
-        if (pos.valid & JackPositionBBT) {
-            int result = model->beats_per_bar * model->frames_per_beat * (pos.bar-1);
-            result += model->frames_per_beat * (pos.beat-1);
-            result += pos.tick * model->frames_per_beat / pos.ticks_per_beat;
-            return result;
-        }
-        */
-        return (int)(((double)model->beats_per_minute * pos.frame / (sample_rate * 60.0))+0.5) * 
-            model->frames_per_beat;
-        //return -1;
-    }
-    
-    virtual bool on_sync(Jack::TransportState state, const Jack::Position &pos) {
-        if (!enable_sync) {
-            waiting_for_sync = false;
-            return true;
-        }
-        
-        bool r_playing = false;
-        
-        switch(state) {
-            case JackTransportStarting:
-            {
-                if (waiting_for_sync) {
-                    if (thread_messages.empty()) {
-                        printf("finished waiting for sync\n");
-                        waiting_for_sync = false;
-                        return true;
-                    } else {
-                        //printf("waiting for sync\n");
-                        return false;
-                    }
-                }
-                waiting_for_sync = true;
-                r_playing = true;
-            } break;
-            case JackTransportStopped:
-            {
-                waiting_for_sync = false;
-                r_playing = false;
-            } break;
-            default: break;
-        }
-        
-        int r_position = get_frame_from_position(pos);
-        if (r_position != get_position()) {
-            ThreadMessage msg;
-            msg.type = MsgSeek;
-            msg.position = r_position;
-            thread_messages.push(msg);
-        }
-        
-        if (r_playing != is_playing()) {
-            ThreadMessage msg;
-            msg.type = (r_playing?MsgPlay:MsgStop);
-            thread_messages.push(msg);            
-        }
-        return false;
-    }
-    
-    virtual void on_process(Jack::NFrames size) {
-        if (enable_sync) {
-            Jack::Position tpos;
-            memset(&tpos, 0, sizeof(tpos));
-            Jack::TransportState tstate = transport_query(&tpos);
-            switch(tstate) {
-                case JackTransportStopped: {
-                    if (is_playing() && thread_messages.empty()) {
-                        ThreadMessage msg;
-                        msg.type = MsgStop;
-                        thread_messages.push(msg);
-                    }
-                } break;
-                default:
-                    break;
-            }
-        }
-        
-        midi_omni_out->clear_buffer();
-        for (MIDIPortArray::iterator iter = midi_ports.begin();
-            iter != midi_ports.end(); ++iter) {
-            (*iter)->clear_buffer();
-        }
-        
-        for (Jack::NFrames i = 0; i < midi_inp->get_event_count(); ++i) {
-            MIDI::Message ctrl_msg;
-            if (midi_inp->get_event(ctrl_msg, NULL, i)) {
-                ctrl_msg.channel = model->midi_control_channel;
-                midi_omni_out->write_event(0, ctrl_msg);
-                midi_ports[model->midi_control_port]->write_event(0, ctrl_msg);
-            }
-        }
-
-        process_messages((int)size);
-    }
-    
-    virtual void on_shutdown() {
-        defunct = true;
-    }
+enum {
+    // how many bars ahead of the play position
+    // lazily loaded patterns are decoded
+    PrefetchBars = 4,
+    // how often changes are appended to the journal, in ms
+    AutosaveInterval = 5000,
+    // journal size at which the song file is rewritten, in bytes
+    JournalCompactSize = 16*1024*1024,
+    // how often a pending transport sync is checked, in ms
+    SyncPollInterval = 5,
+    // how often the status bar shows process statistics, in mix ticks
+    StatsInterval = 10,
 };
 
 class App {
@@ -267,6 +63,10 @@ public:
 
     Glib::RefPtr<Gtk::AccelGroup> accel_group;
     Glib::RefPtr<Gtk::ToggleAction> sync_action;
+    Glib::RefPtr<Gtk::ToggleAction> clock_sync_action;
+    Glib::RefPtr<Gtk::ToggleAction> timebase_action;
+    Glib::RefPtr<Gtk::ToggleAction> record_action;
+    Glib::RefPtr<Gtk::ToggleAction> record_replace_action;
 
     Gtk::Window* window;
     PatternView *pattern_view;
@@ -286,10 +86,25 @@ public:
 
     Gtk::Notebook *view_notebook;
     Glib::OptionContext options;
+    Glib::OptionGroup option_group;
+    // port for midi clock output, or ValueNone
+    int clock_port;
+    // values sent per frame by ramps, or ValueNone for the default
+    int ramp_steps;
+    // print process statistics on exit
+    bool show_stats;
+    int stats_ticks;
+    // set while the bounce dialog runs, the process thread owns
+    // the player then and the song must not change
+    bool bouncing;
 
     sigc::connection mix_timer;
+    sigc::connection sync_timer;
+    sigc::connection autosave_timer;
 
     std::string filepath;
+    JSongJournal journal;
+    Recorder recorder;
     JackPlayer *player;
     
     enum NotebookPages {
@@ -298,7 +113,13 @@ public:
     };
 
     App(int argc, char **argv)
-        : kit(argc,argv) {
+        : kit(argc,argv),
+          option_group("jacker", "Jacker Options", "Show Jacker options") {
+        clock_port = ValueNone;
+        ramp_steps = ValueNone;
+        show_stats = false;
+        stats_ticks = 0;
+        bouncing = false;
         player = NULL;
         pattern_view = NULL;
         song_view = NULL;
@@ -318,6 +139,24 @@ public:
     bool parse_options(int argc, char **argv) {
         options.set_help_enabled(true);
         
+        Glib::OptionEntry clock_port_entry;
+        clock_port_entry.set_long_name("clock-port");
+        clock_port_entry.set_arg_description("PORT");
+        clock_port_entry.set_description("Send MIDI clock and song position on port-PORT");
+        option_group.add_entry(clock_port_entry, clock_port);
+        
+        Glib::OptionEntry ramp_steps_entry;
+        ramp_steps_entry.set_long_name("ramp-steps");
+        ramp_steps_entry.set_arg_description("STEPS");
+        ramp_steps_entry.set_description("Send up to STEPS values per frame for controller ramps");
+        option_group.add_entry(ramp_steps_entry, ramp_steps);
+        
+        Glib::OptionEntry stats_entry;
+        stats_entry.set_long_name("stats");
+        stats_entry.set_description("Print process callback statistics on exit");
+        option_group.add_entry(stats_entry, show_stats);
+        options.set_main_group(option_group);
+        
         bool result = false;
         try {
             result = options.parse(argc, argv);
@@ -436,6 +275,7 @@ public:
             player->seek(0);
         }
         set_filepath("");
+        journal.close();
         model.reset();
         model_changed();
     }
@@ -501,6 +341,19 @@ public:
     void save_song(const std::string &filename) {
         set_filepath(filename);
         write_jsong(model, filename);
+        journal.reset(model, filename);
+    }
+    
+    bool autosave() {
+        if (get_filepath().empty() || bouncing)
+            return true;
+        if (journal.get_size() >= JournalCompactSize) {
+            // compact journal into the song file
+            save_song(get_filepath());
+        } else {
+            journal.write(model);
+        }
+        return true;
     }
     
     bool load_song(const std::string &filename) {
@@ -509,15 +362,239 @@ public:
             player->seek(0);
         }
         try {
-            if (!read_jsong(model, filename))
+            if (!read_jsong(model, filename, true))
                 return false;
             set_filepath(filename);
+            int count = journal.open(model, filename);
+            if (count) {
+                printf("Restored %i changes from %s.\n", count, 
+                    JSongJournal::get_path(filename).c_str());
+            }
         } catch(...) {
             return false;
         }
         return true;
     }
     
+    void deduplicate_patterns() {
+        int count = model.deduplicate_patterns();
+        if (!count)
+            return;
+        printf("Merged %i duplicate patterns.\n", count);
+        // the edited pattern may have been replaced
+        pattern_view->set_song_event(pattern_view->get_song_event());
+        all_views_changed();
+    }
+    
+    // positions in the playlist editor are in bars, followed by
+    // the frames into the bar if they do not start one
+    std::string format_bars(int frame) {
+        int fpbar = std::max(model.get_frames_per_bar(), 1);
+        char buffer[32];
+        if (frame % fpbar)
+            sprintf(buffer, "%i:%i", frame / fpbar, frame % fpbar);
+        else
+            sprintf(buffer, "%i", frame / fpbar);
+        return buffer;
+    }
+    
+    bool parse_bars(const std::string &text, int &frame) {
+        int fpbar = std::max(model.get_frames_per_bar(), 1);
+        const char *pos = text.c_str();
+        char *end = NULL;
+        long bar = strtol(pos, &end, 10);
+        if ((end == pos) || (bar < 0))
+            return false;
+        long offset = 0;
+        if (*end == ':') {
+            pos = end + 1;
+            offset = strtol(pos, &end, 10);
+            if ((end == pos) || (offset < 0))
+                return false;
+        }
+        if (*end)
+            return false;
+        frame = (int)(bar * fpbar + offset);
+        return true;
+    }
+    
+    static void split_words(const std::string &line, 
+                            std::vector<std::string> &words) {
+        std::istringstream stream(line);
+        std::string word;
+        while (stream >> word) {
+            words.push_back(word);
+        }
+    }
+    
+    static std::string join_words(const std::vector<std::string> &words,
+                                  size_t count) {
+        std::string text;
+        for (size_t i = 0; i < count; ++i) {
+            if (i)
+                text += " ";
+            text += words[i];
+        }
+        return text;
+    }
+    
+    // the playlist refers to regions by name, so they need one
+    std::string get_region_name(const RegionArray &regions, int index) {
+        if (!regions[index].name.empty())
+            return regions[index].name;
+        char buffer[32];
+        sprintf(buffer, "Region %i", index + 1);
+        return buffer;
+    }
+    
+    // one region per line: name, first bar, end bar.
+    // lines that can not be read are dropped.
+    void read_regions(const std::string &text, RegionArray &regions) {
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            std::vector<std::string> words;
+            split_words(line, words);
+            if (words.size() < 3)
+                continue;
+            Region region;
+            if (!parse_bars(words[words.size() - 2], region.begin) ||
+                !parse_bars(words[words.size() - 1], region.end) ||
+                (region.end <= region.begin))
+                continue;
+            region.name = join_words(words, words.size() - 2);
+            regions.push_back(region);
+        }
+    }
+    
+    // one entry per line: region name and how often it repeats,
+    // once if left out. unknown regions are dropped.
+    void read_playlist(const std::string &text, const RegionArray &regions,
+                       Playlist &playlist) {
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            std::vector<std::string> words;
+            split_words(line, words);
+            if (words.empty())
+                continue;
+            PlaylistEntry entry;
+            entry.repeat = 1;
+            std::string name = join_words(words, words.size());
+            if (words.size() >= 2) {
+                char *end = NULL;
+                long repeat = strtol(words.back().c_str(), &end, 10);
+                if (!*end && (repeat > 0)) {
+                    // unless the number is part of the name
+                    std::string short_name = join_words(words, words.size() - 1);
+                    for (size_t i = 0; i < regions.size(); ++i) {
+                        if (get_region_name(regions, (int)i) == short_name) {
+                            name = short_name;
+                            entry.repeat = (int)repeat;
+                            break;
+                        }
+                    }
+                }
+            }
+            entry.region = -1;
+            for (size_t i = 0; i < regions.size(); ++i) {
+                if (get_region_name(regions, (int)i) == name) {
+                    entry.region = (int)i;
+                    break;
+                }
+            }
+            if (entry.region >= 0)
+                playlist.push_back(entry);
+        }
+    }
+    
+    void add_loop_region(Glib::RefPtr<Gtk::TextBuffer> buffer) {
+        std::string text = buffer->get_text().raw();
+        RegionArray regions;
+        read_regions(text, regions);
+        char name[32];
+        sprintf(name, "Region %i", (int)regions.size() + 1);
+        std::string line = std::string(name) + " " +
+            format_bars(model.loop.get_begin()) + " " +
+            format_bars(model.loop.get_end()) + "\n";
+        if (!text.empty() && (text[text.size() - 1] != '\n'))
+            line = "\n" + line;
+        buffer->insert(buffer->end(), line);
+    }
+    
+    void on_playlist_action() {
+        std::string regions_text;
+        for (size_t i = 0; i < model.regions.size(); ++i) {
+            const Region &region = model.regions[i];
+            regions_text += get_region_name(model.regions, (int)i) + " " +
+                format_bars(region.begin) + " " + format_bars(region.end) + "\n";
+        }
+        std::string playlist_text;
+        for (Playlist::iterator iter = model.playlist.begin();
+             iter != model.playlist.end(); ++iter) {
+            if ((iter->region < 0) || (iter->region >= (int)model.regions.size()))
+                continue;
+            playlist_text += get_region_name(model.regions, iter->region);
+            if (iter->repeat > 1) {
+                char buffer[16];
+                sprintf(buffer, " %i", iter->repeat);
+                playlist_text += buffer;
+            }
+            playlist_text += "\n";
+        }
+        
+        Gtk::Dialog dialog("Playlist", *window, true);
+        Gtk::Label regions_label("Regions, one per line: name, first bar, end bar");
+        regions_label.set_alignment(0.0f, 0.5f);
+        Gtk::TextView regions_view;
+        regions_view.get_buffer()->set_text(regions_text);
+        Gtk::ScrolledWindow regions_scroll;
+        regions_scroll.set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
+        regions_scroll.set_shadow_type(Gtk::SHADOW_IN);
+        regions_scroll.set_size_request(320, 100);
+        regions_scroll.add(regions_view);
+        Gtk::Button add_loop_button("Add Loop as Region");
+        add_loop_button.signal_clicked().connect(sigc::bind(
+            sigc::mem_fun(*this, &App::add_loop_region), regions_view.get_buffer()));
+        Gtk::Label playlist_label("Playlist, one per line: region name, repeats");
+        playlist_label.set_alignment(0.0f, 0.5f);
+        Gtk::TextView playlist_view;
+        playlist_view.get_buffer()->set_text(playlist_text);
+        Gtk::ScrolledWindow playlist_scroll;
+        playlist_scroll.set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
+        playlist_scroll.set_shadow_type(Gtk::SHADOW_IN);
+        playlist_scroll.set_size_request(320, 100);
+        playlist_scroll.add(playlist_view);
+        Gtk::CheckButton enable_check("Play the Playlist");
+        enable_check.set_active(model.enable_playlist);
+        
+        Gtk::VBox *vbox = dialog.get_vbox();
+        vbox->set_spacing(5);
+        vbox->pack_start(regions_label, false, false);
+        vbox->pack_start(regions_scroll, true, true);
+        vbox->pack_start(add_loop_button, false, false);
+        vbox->pack_start(playlist_label, false, false);
+        vbox->pack_start(playlist_scroll, true, true);
+        vbox->pack_start(enable_check, false, false);
+        vbox->show_all();
+        dialog.add_button(Gtk::Stock::CANCEL, Gtk::RESPONSE_CANCEL);
+        dialog.add_button(Gtk::Stock::OK, Gtk::RESPONSE_OK);
+        dialog.set_default_response(Gtk::RESPONSE_OK);
+        if (dialog.run() != Gtk::RESPONSE_OK)
+            return;
+        
+        RegionArray regions;
+        read_regions(regions_view.get_buffer()->get_text().raw(), regions);
+        Playlist playlist;
+        read_playlist(playlist_view.get_buffer()->get_text().raw(), regions, playlist);
+        model.regions = regions;
+        model.playlist = playlist;
+        model.enable_playlist = enable_check.get_active();
+        // takes effect right away while playing
+        if (player)
+            player->update_playlist();
+    }
+    
     void all_views_changed() {
         pattern_view->invalidate();
         song_view->invalidate();
@@ -586,6 +663,97 @@ public:
         player->enable_sync = sync_action->get_active();
     }
     
+    void on_timebase_action() {
+        if (!player)
+            return;
+        player->set_timebase_master(timebase_action->get_active());
+        timebase_action->set_active(player->is_timebase_master());
+    }
+    
+    void on_bounce_action() {
+        if (!player || player->is_bouncing())
+            return;
+        model.load_patterns();
+        int end = model.get_song_end();
+        if (end <= 0)
+            return;
+        
+        Gtk::Dialog dialog("Bounce Song", *window, true);
+        Gtk::Label label("Playing the song in freewheel mode.");
+        Gtk::ProgressBar progress;
+        dialog.get_vbox()->pack_start(label);
+        dialog.get_vbox()->pack_start(progress);
+        dialog.add_button(Gtk::Stock::CANCEL, Gtk::RESPONSE_CANCEL);
+        label.show();
+        progress.show();
+        
+        sigc::connection timer = Glib::signal_timeout().connect(
+            sigc::bind(sigc::mem_fun(*this, &App::update_bounce), 
+                &dialog, &progress, end), 100);
+        // loops would never reach the end, and the song is
+        // bounced as it is arranged
+        bool enable_loop = model.enable_loop;
+        bool enable_playlist = model.enable_playlist;
+        model.enable_loop = false;
+        model.enable_playlist = false;
+        player->update_playlist();
+        // pauses the mix and autosave timers
+        bouncing = true;
+        player->start_bounce(0, end);
+        while (player->is_bouncing()) {
+            if (dialog.run() != Gtk::RESPONSE_OK)
+                player->cancel_bounce();
+        }
+        timer.disconnect();
+        player->finish_bounce();
+        model.enable_loop = enable_loop;
+        model.enable_playlist = enable_playlist;
+        bouncing = false;
+    }
+    
+    bool update_bounce(Gtk::Dialog *dialog, Gtk::ProgressBar *progress, int end) {
+        if (!player->is_bouncing()) {
+            dialog->response(Gtk::RESPONSE_OK);
+            return true;
+        }
+        progress->set_fraction(
+            std::min(1.0, (double)player->get_position() / (double)end));
+        return true;
+    }
+    
+    void on_clock_sync_action() {
+        if (!player)
+            return;
+        player->set_clock_sync(clock_sync_action->get_active());
+    }
+    
+    void on_record_action() {
+        if (!player)
+            return;
+        recorder.reset();
+        player->set_recording(record_action->get_active());
+    }
+    
+    void on_record_replace_action() {
+        recorder.set_mode(record_replace_action->get_active()?
+            Recorder::ModeReplace:Recorder::ModeOverdub);
+    }
+    
+    // moves recorded MIDI input into the edited pattern
+    void record() {
+        if (!player->is_recording())
+            return;
+        Song::iterator event = pattern_view->get_song_event();
+        if (event == model.song.end()) {
+            recorder.discard(*player);
+            return;
+        }
+        int channel = pattern_view->get_cursor().get_channel();
+        int count = recorder.process(*player, event->second, channel);
+        if (count || (recorder.get_mode() == Recorder::ModeReplace))
+            pattern_view->invalidate();
+    }
+    
     void init_menu() {
         connect_action("new_action", sigc::mem_fun(*this, &App::on_new_action));
         connect_action("open_action", sigc::mem_fun(*this, &App::on_open_action),
@@ -593,6 +761,7 @@ public:
         connect_action("save_action", sigc::mem_fun(*this, &App::on_save_action),
             AccelPathSave);
         connect_action("save_as_action", sigc::mem_fun(*this, &App::on_save_as_action));
+        connect_action("bounce_action", sigc::mem_fun(*this, &App::on_bounce_action));
         connect_action("quit_action", sigc::mem_fun(*this, &App::on_quit_action));
         connect_action("about_action", sigc::mem_fun(*this, &App::on_about_action));
     
@@ -604,10 +773,21 @@ public:
             AccelPathTrackView);
     
         sync_action = connect_toggle_action("sync_action", sigc::mem_fun(*this, &App::on_sync_action));
+        clock_sync_action = connect_toggle_action("clock_sync_action", 
+            sigc::mem_fun(*this, &App::on_clock_sync_action));
+        timebase_action = connect_toggle_action("timebase_action", 
+            sigc::mem_fun(*this, &App::on_timebase_action));
+        record_action = connect_toggle_action("record_action", 
+            sigc::mem_fun(*this, &App::on_record_action));
+        record_replace_action = connect_toggle_action("record_replace_action", 
+            sigc::mem_fun(*this, &App::on_record_replace_action));
     }
 
     void on_bpm_changed() {
-        model.beats_per_minute = int(bpm_range->get_value()+0.5);
+        int bpm = int(bpm_range->get_value()+0.5);
+        if (bpm == model.beats_per_minute)
+            return;
+        model.beats_per_minute = bpm;
         if (player)
             player->flush();
     }
@@ -797,6 +977,10 @@ public:
         
         connect_action("add_track_action", 
             sigc::mem_fun(*song_view, &SongView::add_track));
+        connect_action("deduplicate_patterns_action", 
+            sigc::mem_fun(*this, &App::deduplicate_patterns));
+        connect_action("playlist_action", 
+            sigc::mem_fun(*this, &App::on_playlist_action));
             
         builder->get_widget_derived("song_measure", song_measure);
         assert(song_measure);
@@ -812,15 +996,21 @@ public:
         track_view->set_model(model);        
         track_view->signal_mute_toggled().connect(
             sigc::mem_fun(*this, &App::on_track_view_mute_toggled));
+        track_view->signal_solo_toggled().connect(
+            sigc::mem_fun(*this, &App::on_track_view_solo_toggled));
 
     }
     
     void on_track_view_mute_toggled(int index, bool mute) {
         if (!player)
             return;
-        if (mute) {
-            player->stop_events(index);
-        }
+        player->update_mute();
+    }
+    
+    void on_track_view_solo_toggled(int index, bool solo) {
+        if (!player)
+            return;
+        player->update_mute();
     }
     
     void init_timer() {
@@ -828,6 +1018,17 @@ public:
             sigc::mem_fun(*this, &App::mix), 0);
         mix_timer = Glib::signal_timeout().connect(mix_timer_slot,
             100);
+        autosave_timer = Glib::signal_timeout().connect(
+            sigc::mem_fun(*this, &App::autosave), AutosaveInterval);
+        sync_timer = Glib::signal_timeout().connect(
+            sigc::mem_fun(*this, &App::poll_sync), SyncPollInterval);
+    }
+    
+    // answers transport requests without waiting for the mix timer
+    bool poll_sync() {
+        if (player && player->waiting_for_sync)
+            player->process_thread_messages();
+        return true;
     }
     
     void shutdown_player() {
@@ -837,6 +1038,12 @@ public:
             player->deactivate();
             player->shutdown();
         }
+        player->print_port_stats();
+        if (show_stats) {
+            player->get_stats().print();
+            printf("premix queue: %i of %i messages used at most\n",
+                player->get_queue_high_water(), player->get_queue_capacity());
+        }
         delete player;
         player = NULL;
     }
@@ -846,6 +1053,10 @@ public:
             return;
         player = new JackPlayer();
         player->set_model(model);
+        if ((clock_port >= 0) && (clock_port < MaxPorts))
+            player->set_clock_port(clock_port);
+        if (ramp_steps != ValueNone)
+            player->set_ramp_steps(ramp_steps);
         if (!player->init()) {
             shutdown_player();
         }
@@ -940,11 +1151,17 @@ public:
         kit.run(*window);
         
         mix_timer.disconnect();
+        sync_timer.disconnect();
+        autosave_timer.disconnect();
+        autosave();
         
         shutdown_player();
     }
     
     bool mix(int i) {
+        if (bouncing)
+            return true;
+        
         // check if player is dead
         if (player && player->defunct) {
             shutdown_player();
@@ -952,8 +1169,18 @@ public:
         
         int frame = 0;
         if (player) {
+            model.prefetch_patterns(player->get_position(),
+                model.get_frames_per_bar() * PrefetchBars);
+            player->update_ports();
+            player->update_mute();
+            player->update_playlist();
+            player->update_latency();
             player->mix();
+            record();
             frame = player->get_position();
+            // tempo may follow an external clock
+            if (int(bpm_range->get_value()+0.5) != model.beats_per_minute)
+                bpm_range->set_value(model.beats_per_minute);
         }
         
         Measure measure;
@@ -974,7 +1201,8 @@ public:
                     Song::Event &evt = (*iter)->second;
                     if (evt.pattern == active_pattern) {
                         found = true;
-                        pattern_view->set_play_position(frame - evt.frame);
+                        pattern_view->set_play_position(
+                            evt.get_pattern_frame(frame));
                         break;
                     }
                 }
@@ -982,8 +1210,23 @@ public:
         }
         if (!found)
             pattern_view->set_play_position(-1);
+        
+        if (player && (++stats_ticks >= StatsInterval)) {
+            stats_ticks = 0;
+            update_stats();
+        }
         return true;
     }
+    
+    void update_stats() {
+        const Jack::ProcessStats &stats = player->get_stats();
+        char text[256];
+        sprintf(text, "DSP %.1f%% (max %.1f%%)   xruns %u   lost %u   queue %.0f%%",
+            stats.load * 100.0f, stats.max_load * 100.0f,
+            stats.xruns, stats.lost_events, stats.queue_fill * 100.0f);
+        statusbar->pop();
+        statusbar->push(text);
+    }
 };
     
 } // namespace Jacker
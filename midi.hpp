@@ -59,7 +59,7 @@ struct Message {
 			unsigned char data2;
 			unsigned char data3; // usually unused
 		};
-		long data;
+		int data;
 		unsigned char bytes[4];
 	};
     
@@ -76,6 +76,21 @@ struct Message {
 	bool operator !=(const Message &other) const {
         return !(*this == other);
     }
+    
+    // returns the length of the message in bytes
+    int get_size() const {
+        if (status >= StatusSysEx) {
+            switch(status) {
+                case StatusSongPosition: return 3;
+                case StatusSongSelect: return 2;
+                default: return 1;
+            }
+        }
+        if ((command == CommandProgramChange) ||
+            (command == CommandChannelPressure))
+            return 2;
+        return 3;
+    }
 };
 
 //=============================================================================
@@ -141,13 +141,94 @@ int Pattern::Row::get_value(int channel, int param) const {
 
 //=============================================================================
 
+void PatternLoader::load_all(PatternList &patterns) {
+    for (PatternList::iterator iter = patterns.begin(); 
+         iter != patterns.end(); ++iter) {
+        (*iter)->load();
+    }
+}
+
+//=============================================================================
+
+// patterns are only created on the main thread
+static long long next_pattern_revision = 0;
+
 Pattern::Pattern() {
     length = 1;
     channel_count = 1;
     refcount = 0;
+    loader = NULL;
+    revision = next_pattern_revision;
+    next_pattern_revision += (long long)1 << 32;
+}
+
+long long Pattern::get_revision() const {
+    return revision;
+}
+
+void Pattern::touch() {
+    revision++;
+}
+
+unsigned int Pattern::get_hash() const {
+    load();
+    unsigned int hash = 2166136261u;
+    hash = hash_value(hash, length);
+    hash = hash_value(hash, channel_count);
+    // events on the same frame can come in any order,
+    // so event hashes are combined commutatively.
+    unsigned int events_hash = 0;
+    for (const_iterator iter = begin(); iter != end(); ++iter) {
+        unsigned int event_hash = 2166136261u;
+        event_hash = hash_value(event_hash, iter->second.frame);
+        event_hash = hash_value(event_hash, iter->second.channel);
+        event_hash = hash_value(event_hash, iter->second.param);
+        event_hash = hash_value(event_hash, iter->second.value);
+        events_hash += event_hash;
+    }
+    return hash_value(hash, (int)events_hash);
+}
+
+bool Pattern::same_contents(const Pattern &other) const {
+    load();
+    other.load();
+    if ((length != other.length) || (channel_count != other.channel_count))
+        return false;
+    if (size() != other.size())
+        return false;
+    Pattern &pattern = const_cast<Pattern &>(other);
+    for (const_iterator iter = begin(); iter != end(); ++iter) {
+        const Event &event = iter->second;
+        iterator other_iter = pattern.get_event(event.frame, event.channel, 
+            event.param);
+        if (other_iter == pattern.end())
+            return false;
+        if (other_iter->second.value != event.value)
+            return false;
+    }
+    return true;
+}
+
+void Pattern::load() const {
+    if (!loader)
+        return;
+    // reset first, so the loader can use the regular interface
+    PatternLoader *pending = loader;
+    loader = NULL;
+    pending->load(const_cast<Pattern &>(*this));
+}
+
+bool Pattern::is_loaded() const {
+    return (loader == NULL);
+}
+
+void Pattern::set_loader(PatternLoader *loader) {
+    this->loader = loader;
 }
 
 Pattern::iterator Pattern::add_event(const Event &event) {
+    load();
+    touch();
     assert(event.is_valid());
     assert(event.frame < length);
     assert(event.channel < channel_count);
@@ -166,7 +247,62 @@ Pattern::iterator Pattern::add_event(int frame, int channel, int param, int valu
     return add_event(Event(frame,channel,param,value));
 }
 
+void Pattern::merge_events(const Event *events, int count) {
+    load();
+    touch();
+    // existing events on the current frame, indexed by channel and param
+    int slot_count = channel_count*ParamCount;
+    std::vector<iterator> slots(slot_count);
+    std::vector<int> slot_frames(slot_count, ValueNone);
+    
+    iterator pos = begin();
+    int frame = ValueNone;
+    for (int i = 0; i < count; ++i) {
+        const Event &event = events[i];
+        assert(event.is_valid());
+        assert(event.frame < length);
+        assert(event.channel < channel_count);
+        assert(event.param < ParamCount);
+        if (event.frame != frame) {
+            assert(event.frame > frame);
+            frame = event.frame;
+            while ((pos != end()) && (pos->first < frame))
+                ++pos;
+            for (iterator iter = pos; 
+                 (iter != end()) && (iter->first == frame); ++iter) {
+                int slot = iter->second.channel*ParamCount + iter->second.param;
+                slots[slot] = iter;
+                slot_frames[slot] = frame;
+            }
+        }
+        int slot = event.channel*ParamCount + event.param;
+        if (slot_frames[slot] == frame) {
+            // replace event
+            slots[slot]->second.value = event.value;
+        } else {
+            slots[slot] = insert(pos, value_type(frame, event));
+            slot_frames[slot] = frame;
+        }
+    }
+}
+
+void Pattern::erase_events(int frame0, int frame1, int channel0, int channel1) {
+    load();
+    touch();
+    iterator end = lower_bound(frame1);
+    iterator iter = lower_bound(frame0);
+    while (iter != end) {
+        int channel = iter->second.channel;
+        if ((channel >= channel0) && (channel < channel1))
+            erase(iter++);
+        else
+            ++iter;
+    }
+}
+
 void Pattern::set_length(int length) {
+    load();
+    touch();
     this->length = length;
     bool clipped = false;
     for (iterator iter = begin(); iter != end(); ++iter) {
@@ -184,6 +320,8 @@ int Pattern::get_length() const {
 }
 
 void Pattern::set_channel_count(int count) {
+    load();
+    touch();
     this->channel_count = std::min(std::max(count, 1), (int)MaxChannels);
     bool clipped = false;
     for (iterator iter = begin(); iter != end(); ++iter) {
@@ -201,6 +339,7 @@ int Pattern::get_channel_count() const {
 }
 
 void Pattern::collect_events(int frame, iterator &iter, Row &row) {
+    load();
      // resize and reset row
     row.resize(channel_count);
     
@@ -215,6 +354,7 @@ void Pattern::collect_events(int frame, iterator &iter, Row &row) {
 }
 
 Pattern::iterator Pattern::get_event(int frame, int channel, int param) {
+    load();
     iterator iter = lower_bound(frame);
     if (iter == end())
         return iter;
@@ -228,6 +368,8 @@ Pattern::iterator Pattern::get_event(int frame, int channel, int param) {
 }
 
 void Pattern::update_keys() {
+    load();
+    touch();
     IterList dead_iters;
     EventList events;
     
@@ -252,6 +394,8 @@ void Pattern::update_keys() {
 }
 
 void Pattern::copy_from(const Pattern &pattern) {
+    pattern.load();
+    touch();
     name = pattern.name;
     length = pattern.length;
     channel_count = pattern.channel_count;
@@ -268,24 +412,47 @@ SongEvent::SongEvent() {
     frame = ValueNone;
     pattern = NULL;
     track = 0;
+    length = ValueNone;
 }
 
 SongEvent::SongEvent(int frame, int track, Pattern &pattern) {
     this->frame = frame;
     this->track = track;
     this->pattern = &pattern;
+    this->length = ValueNone;
 }
 
 int SongEvent::key() const {
     return frame;
 }
 
+int SongEvent::get_length() const {
+    if (length == ValueNone)
+        return pattern->get_length();
+    return length;
+}
+
+void SongEvent::set_length(int length) {
+    if (length == pattern->get_length())
+        this->length = ValueNone;
+    else
+        this->length = std::max(length, 1);
+}
+
 int SongEvent::get_last_frame() const {
-    return frame + pattern->get_length() - 1;
+    return frame + get_length() - 1;
 }
 
 int SongEvent::get_end() const {
-    return frame + pattern->get_length();
+    return frame + get_length();
+}
+
+int SongEvent::get_pattern_frame(int frame) const {
+    int offset = frame - this->frame;
+    int pattern_length = pattern->get_length();
+    if ((offset <= 0) || (pattern_length <= 0))
+        return offset;
+    return offset % pattern_length;
 }
 
 //=============================================================================
@@ -417,15 +584,42 @@ Track::Track() {
     midi_port = 0;
     midi_channel = 0;
     mute = false;
+    solo = false;
+    latency = 0;
+}
+
+//=============================================================================
+
+Region::Region() {
+    begin = 0;
+    end = 0;
+}
+
+//=============================================================================
+
+PlaylistEntry::PlaylistEntry() {
+    region = 0;
+    repeat = 1;
 }
 
 //=============================================================================
 
 Model::Model() {
+    pattern_loader = NULL;
     reset();
 }
 
+Model::~Model() {
+    set_pattern_loader(NULL);
+}
+
 void Model::reset() {
+    // the patterns are discarded, so there's nothing left to decode
+    for (PatternList::iterator iter = patterns.begin(); 
+         iter != patterns.end(); ++iter) {
+        (*iter)->set_loader(NULL);
+    }
+    set_pattern_loader(NULL);
     end_cue = 0;
     midi_control_port = 0;
     midi_control_channel = 0;
@@ -434,6 +628,9 @@ void Model::reset() {
     beats_per_bar = 4;
     enable_loop = true;
     loop.set(get_frames_per_bar()*4,get_frames_per_bar()*8);
+    enable_playlist = false;
+    regions.clear();
+    playlist.clear();
     song.clear();
     tracks.clear();
     patterns.clear();
@@ -498,11 +695,97 @@ void Model::delete_unused_patterns() {
     printf("deleting %i unused patterns.\n", dead_iters.size());
     for (PatternIterList::iterator iter = dead_iters.begin(); 
          iter != dead_iters.end(); ++iter) {
-        delete *(*iter);
+        delete_pattern(*(*iter));
         patterns.erase(*iter);
     } 
 }
 
+void Model::delete_pattern(Pattern *pattern) {
+    if (pattern_loader)
+        pattern_loader->forget(pattern);
+    for (size_t i = 0; i < pattern_observers.size(); ++i) {
+        pattern_observers[i]->forget(pattern);
+    }
+    delete pattern;
+}
+
+int Model::deduplicate_patterns() {
+    typedef std::multimap<unsigned int, Pattern *> HashMap;
+    typedef std::map<Pattern *, Pattern *> PatternMap;
+    HashMap hashes;
+    PatternMap duplicates;
+    
+    for (PatternList::iterator iter = patterns.begin(); 
+         iter != patterns.end(); ++iter) {
+        Pattern *pattern = *iter;
+        unsigned int hash = pattern->get_hash();
+        std::pair<HashMap::iterator, HashMap::iterator> range = 
+            hashes.equal_range(hash);
+        bool found = false;
+        for (HashMap::iterator jter = range.first; jter != range.second; ++jter) {
+            if (jter->second->same_contents(*pattern)) {
+                duplicates[pattern] = jter->second;
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            hashes.insert(HashMap::value_type(hash, pattern));
+    }
+    
+    if (duplicates.empty())
+        return 0;
+    
+    for (Song::iterator iter = song.begin(); iter != song.end(); ++iter) {
+        PatternMap::iterator found = duplicates.find(iter->second.pattern);
+        if (found != duplicates.end())
+            iter->second.pattern = found->second;
+    }
+    
+    int count = (int)patterns.size();
+    delete_unused_patterns();
+    return count - (int)patterns.size();
+}
+
+void Model::set_pattern_loader(PatternLoader *loader) {
+    if (pattern_loader == loader)
+        return;
+    if (pattern_loader) {
+        // patterns must not refer to the old loader anymore
+        pattern_loader->load_all(patterns);
+        delete pattern_loader;
+    }
+    pattern_loader = loader;
+}
+
+void Model::load_patterns() {
+    if (pattern_loader)
+        pattern_loader->load_all(patterns);
+}
+
+void Model::prefetch_patterns(int frame, int count) {
+    if (!pattern_loader)
+        return;
+    int end = frame + count;
+    for (Song::iterator iter = song.begin(); iter != song.end(); ++iter) {
+        if (iter->second.frame >= end)
+            break;
+        if (iter->second.get_end() <= frame)
+            continue;
+        iter->second.pattern->load();
+    }
+}
+
+int Model::get_song_end() {
+    if (end_cue > 0)
+        return end_cue;
+    int end = 0;
+    for (Song::iterator iter = song.begin(); iter != song.end(); ++iter) {
+        end = std::max(end, iter->second.get_end());
+    }
+    return end;
+}
+
 std::string Model::get_param_name(int param) const {
     switch(param) {
         case ParamNote: return "Note";
@@ -73,6 +73,27 @@ enum {
     NoteOff = 255,
 };
 
+//=============================================================================
+
+// FNV-1a steps, to find out whether song data changed
+inline unsigned int hash_value(unsigned int hash, int value) {
+    for (int i = 0; i < 4; ++i) {
+        hash ^= (unsigned int)(value & 0xff);
+        hash *= 16777619u;
+        value >>= 8;
+    }
+    return hash;
+}
+
+inline unsigned int hash_value(unsigned int hash, const std::string &text) {
+    hash = hash_value(hash, (int)text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
 enum {
     ParamNote = 0,
     ParamVolume,
@@ -87,7 +108,7 @@ enum {
 enum {
     MaxTracks = 32,
     MaxChannels = 256,
-    MaxPorts = 16,
+    MaxPorts = 128,
 };
 
 //=============================================================================
@@ -128,6 +149,29 @@ struct PatternEvent {
 
 //=============================================================================
 
+class Pattern;
+
+// keeps state per pattern, which has to be dropped before
+// the pattern is deleted, as a new one may get its address
+class PatternObserver {
+public:
+    virtual ~PatternObserver() {}
+    virtual void forget(Pattern *pattern) = 0;
+};
+
+// decodes the contents of a pattern on first access
+class PatternLoader : public PatternObserver {
+public:
+    virtual ~PatternLoader() {}
+    virtual void load(Pattern &pattern) = 0;
+    // decodes all patterns that are still pending,
+    // by default one after the other
+    virtual void load_all(std::list<class Pattern *> &patterns);
+    virtual void forget(Pattern *pattern) {}
+};
+
+//=============================================================================
+
 class Pattern : public EventCollection< std::multimap<int,PatternEvent> > {
     friend class Model;
 public:
@@ -147,6 +191,11 @@ public:
     
     iterator add_event(const Event &event);
     iterator add_event(int frame, int channel, int param, int value);
+    // adds or replaces a block of events sorted by frame in one pass
+    void merge_events(const Event *events, int count);
+    // removes all events in frames [frame0,frame1) and 
+    // channels [channel0,channel1)
+    void erase_events(int frame0, int frame1, int channel0, int channel1);
     
     void set_length(int length);
     int get_length() const;
@@ -160,12 +209,32 @@ public:
     void update_keys();
     void copy_from(const Pattern &pattern);
     
+    // hash of length, channel count and events, names are ignored
+    unsigned int get_hash() const;
+    // changes with every edit and differs between patterns, so
+    // edits can be found without looking at the events. code that
+    // changes events through the map itself must call touch().
+    long long get_revision() const;
+    void touch();
+    // true if length, channel count and events are identical
+    bool same_contents(const Pattern &other) const;
+    
+    // decodes pending events, if the pattern was loaded lazily
+    void load() const;
+    bool is_loaded() const;
+    void set_loader(PatternLoader *loader);
+    
     Pattern();
 protected:
     // length in frames
     int length;
     // number of channels
     int channel_count;
+    // pending loader, NULL if all events are present
+    mutable PatternLoader *loader;
+    // serial number of the pattern in the upper 32 bits,
+    // number of edits in the lower ones
+    long long revision;
 };
 
 //=============================================================================
@@ -174,13 +243,20 @@ struct SongEvent {
     int frame;
     int track;
     Pattern *pattern;
+    // length in frames, ValueNone if as long as the pattern.
+    // the pattern repeats in longer events.
+    int length;
     
     SongEvent();
     SongEvent(int frame, int track, Pattern &pattern);
     
     int key() const;
+    int get_length() const;
+    void set_length(int length);
     int get_last_frame() const;
     int get_end() const;
+    // returns the pattern frame played at the given song frame
+    int get_pattern_frame(int frame) const;
 };
 
 //=============================================================================
@@ -239,15 +315,48 @@ public:
     int midi_port;
     int midi_channel;
     bool mute;
+    // if any track is solo, only solo tracks play
+    bool solo;
+    // output latency of the instrument that is not reported
+    // by its port, in ms
+    int latency;
+    // delay of the notes of each frame in 1/256 frame, repeating
+    // from the song start, for swing and grooves. empty plays
+    // straight.
+    std::vector<int> groove;
 
     Track();
 };
 
 
+//=============================================================================
+
+// a named range of the song, for the playlist
+class Region {
+public:
+    std::string name;
+    int begin;
+    int end;
+    
+    Region();
+};
+
+// plays a region a number of times
+class PlaylistEntry {
+public:
+    // index into Model::regions
+    int region;
+    int repeat;
+    
+    PlaylistEntry();
+};
+
 //=============================================================================
 
 typedef std::list<Pattern*> PatternList;
 typedef std::vector<Track> TrackArray;
+typedef std::vector<Region> RegionArray;
+typedef std::vector<PlaylistEntry> Playlist;
 
 class Model {
 public:
@@ -265,6 +374,14 @@ public:
     // tells if the loop is enabled
     bool enable_loop;
     
+    // named ranges of the song
+    RegionArray regions;
+    // the order regions are played in
+    Playlist playlist;
+    // tells if the playlist is enabled. it takes the place
+    // of the loop until its last entry ended.
+    bool enable_playlist;
+    
     // end cue in frames
     int end_cue;
     // how many frames are in one beat
@@ -278,10 +395,16 @@ public:
     int midi_control_port;
     // what channel to use for the midi control
     int midi_control_channel;
+    
+    // decodes lazily loaded patterns, owned by the model
+    PatternLoader *pattern_loader;
+    // told before a pattern is deleted, not owned by the model
+    std::vector<PatternObserver *> pattern_observers;
 
     void reset();
     
     Model();
+    ~Model();
     Pattern &new_pattern(const Pattern *template_pattern=NULL);
     
     int get_track_count() const;
@@ -289,7 +412,21 @@ public:
     int get_frames_per_bar() const;
     
     void update_pattern_refcount();
+    // tells the loader and observers, then deletes the pattern
+    void delete_pattern(Pattern *pattern);
     void delete_unused_patterns();
+    // makes song events share patterns with identical contents
+    // and returns the number of removed patterns
+    int deduplicate_patterns();
+    
+    void set_pattern_loader(PatternLoader *loader);
+    // decodes all patterns that are still pending
+    void load_patterns();
+    // decodes all patterns played within the given frame range
+    void prefetch_patterns(int frame, int count);
+    // returns the end cue if set, otherwise the end of the
+    // last song event
+    int get_song_end();
     
     std::string get_param_name(int param) const;
     std::string format_param_value(int param, int value) const;
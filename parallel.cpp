@@ -0,0 +1,72 @@
+#include "parallel.hpp"
+
+#include <glib.h>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Jacker {
+
+//=============================================================================
+
+struct ParallelTask {
+    ParallelFunc func;
+    void *data;
+};
+
+// items are pushed as index+1, because a NULL item can't be queued
+static void parallel_worker(gpointer item, gpointer user_data) {
+    ParallelTask *task = (ParallelTask *)user_data;
+    task->func(GPOINTER_TO_INT(item) - 1, task->data);
+}
+
+int get_worker_count() {
+#if defined(WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int count = (int)info.dwNumberOfProcessors;
+#else
+    int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return (count > 0)?count:1;
+}
+
+void parallel_for(int count, ParallelFunc func, void *data) {
+    int workers = get_worker_count();
+    if (workers > count)
+        workers = count;
+    if (workers <= 1) {
+        // not worth the trouble
+        for (int i = 0; i < count; ++i) {
+            func(i, data);
+        }
+        return;
+    }
+    
+    ParallelTask task;
+    task.func = func;
+    task.data = data;
+    
+    // idle workers pick the next index from the shared queue,
+    // so a few large items don't stall the rest.
+    GThreadPool *pool = g_thread_pool_new(&parallel_worker, &task, 
+        workers, TRUE, NULL);
+    if (!pool) {
+        for (int i = 0; i < count; ++i) {
+            func(i, data);
+        }
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        g_thread_pool_push(pool, GINT_TO_POINTER(i+1), NULL);
+    }
+    // wait for all items to be processed
+    g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+//=============================================================================
+
+} // namespace Jacker
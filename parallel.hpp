@@ -0,0 +1,20 @@
+#pragma once
+
+namespace Jacker {
+
+//=============================================================================
+
+typedef void (*ParallelFunc)(int index, void *data);
+
+// returns the number of worker threads that should be used
+int get_worker_count();
+
+// calls func(index, data) once for every index in [0, count) on a pool
+// of worker threads and returns when all calls have finished. indices
+// are handed out in ascending order, but may finish in any order.
+// func must not touch state shared between indices.
+void parallel_for(int count, ParallelFunc func, void *data);
+
+//=============================================================================
+
+} // namespace Jacker
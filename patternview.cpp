@@ -47,6 +47,76 @@ enum {
 };
 
 static const char TargetFormatPattern[] = "jacker_pattern_block";
+static const char TargetFormatPatternBinary[] = "jacker_pattern_block_binary";
+
+//=============================================================================
+
+// binary blocks are a header of two little endian 32-bit ints
+// (length, event count) followed by 8 bytes per event: 32-bit frame,
+// 16-bit channel, 8-bit param and 8-bit value. events are sorted by frame.
+
+enum {
+    BlockHeaderSize = 8,
+    BlockEventSize = 8,
+};
+
+typedef std::vector<Pattern::Event> PatternEventArray;
+
+static void write_block_int(std::string &data, int value, int size) {
+    for (int i = 0; i < size; ++i) {
+        data.push_back((char)(value & 0xff));
+        value >>= 8;
+    }
+}
+
+static int read_block_int(const unsigned char *data, int size) {
+    int value = 0;
+    for (int i = size-1; i >= 0; --i) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+static void encode_block(std::string &data, int length, 
+                         const PatternEventArray &events) {
+    data.clear();
+    data.reserve(BlockHeaderSize + events.size()*BlockEventSize);
+    write_block_int(data, length, 4);
+    write_block_int(data, (int)events.size(), 4);
+    for (PatternEventArray::const_iterator iter = events.begin();
+         iter != events.end(); ++iter) {
+        write_block_int(data, iter->frame, 4);
+        write_block_int(data, iter->channel, 2);
+        write_block_int(data, iter->param, 1);
+        write_block_int(data, iter->value, 1);
+    }
+}
+
+static bool decode_block(const std::string &data, int &length,
+                         PatternEventArray &events) {
+    if (data.size() < BlockHeaderSize)
+        return false;
+    const unsigned char *ptr = (const unsigned char *)data.data();
+    length = read_block_int(ptr, 4);
+    int count = read_block_int(ptr + 4, 4);
+    if ((count < 0) || 
+        (data.size() != BlockHeaderSize + (size_t)count*BlockEventSize))
+        return false;
+    ptr += BlockHeaderSize;
+    events.resize(count);
+    for (int i = 0; i < count; ++i) {
+        Pattern::Event &event = events[i];
+        event.frame = read_block_int(ptr, 4);
+        event.channel = read_block_int(ptr + 4, 2);
+        event.param = read_block_int(ptr + 6, 1);
+        event.value = read_block_int(ptr + 7, 1);
+        if ((event.param >= ParamCount) || 
+            (i && (event.frame < events[i-1].frame)))
+            return false;
+        ptr += BlockEventSize;
+    }
+    return true;
+}
 
 //=============================================================================
 
@@ -783,6 +853,8 @@ void PatternView::set_model(class Model &model) {
 
 void PatternView::set_song_event(Song::iterator event) {
     song_event = event;
+    if (get_pattern())
+        get_pattern()->load();
     selection.set_active(false);
     invalidate();
     update_adjustments();
@@ -792,6 +864,10 @@ Song::iterator PatternView::get_song_event() {
     return song_event;
 }
 
+const PatternCursor &PatternView::get_cursor() const {
+    return cursor;
+}
+
 void PatternView::on_realize() {
     Gtk::Widget::on_realize();
     
@@ -1203,6 +1279,7 @@ void PatternView::transpose(int step) {
 	iter->second.value += step;
 	iter->second.sanitize_value();
     }    
+    get_pattern()->touch();
     
     invalidate_selection();
 }
@@ -1234,11 +1311,38 @@ void PatternView::move_frames(int step, bool all_channels/*=false*/) {
 
 void PatternView::on_clipboard_get(Gtk::SelectionData &data, guint info) {
     const std::string target = data.get_target();
+    if (target == TargetFormatPatternBinary) {
+        data.set(TargetFormatPatternBinary, 8, 
+            (const guint8 *)clipboard_block.data(), clipboard_block.size());
+        return;
+    }
     if (target != TargetFormatPattern) {
         printf("can't provide target %s\n", target.c_str());
         return;
     }
-    data.set(TargetFormatPattern, clipboard_jsong);
+    // the JSong block is only built when requested
+    int length;
+    PatternEventArray events;
+    if (!decode_block(clipboard_block, length, events))
+        return;
+    int channel_count = 1;
+    for (PatternEventArray::iterator iter = events.begin();
+         iter != events.end(); ++iter) {
+        channel_count = std::max(channel_count, iter->channel + 1);
+    }
+    Pattern block;
+    block.set_length(length);
+    block.set_channel_count(channel_count);
+    if (!events.empty())
+        block.merge_events(&events[0], (int)events.size());
+    
+    JSongWriter jsong_writer;
+    Json::Value root;
+    jsong_writer.collect(root,block);
+    if (root.empty())
+        return;
+    Json::StyledWriter writer;
+    data.set(TargetFormatPattern, writer.write(root));
 }
 
 void PatternView::on_clipboard_clear() {
@@ -1249,38 +1353,64 @@ void PatternView::on_clipboard_received(const Gtk::SelectionData &data) {
     if (!pattern)
         return;
     const std::string target = data.get_target();
-    if (target != TargetFormatPattern) {
+    PatternEventArray events;
+    if (target == TargetFormatPatternBinary) {
+        if (data.get_length() <= 0) {
+            // not offered, fall back to JSong
+            Glib::RefPtr<Gtk::Clipboard> clipboard = Gtk::Clipboard::get();
+            clipboard->request_contents(TargetFormatPattern,
+                sigc::mem_fun(*this, &PatternView::on_clipboard_received));
+            return;
+        }
+        int length;
+        if (!decode_block(data.get_data_as_string(), length, events)) {
+            printf("Error decoding pattern block.\n");
+            return;
+        }
+    } else if (target == TargetFormatPattern) {
+        std::string text = data.get_data_as_string();
+        if (text.empty())
+            return;
+        
+        Json::Reader reader;
+        Json::Value root;
+        if (!reader.parse(text, root)) {
+            std::cout << "Error parsing JSong: " << reader.getFormatedErrorMessages();
+            return;
+        }
+        
+        JSongReader jsong_reader;
+        Pattern block;
+        jsong_reader.build(root, block);
+        if (root.empty())
+            return;
+        for (Pattern::iterator iter = block.begin(); iter != block.end();
+             iter++) {
+            events.push_back(iter->second);
+        }
+    } else {
         printf("can't receive target %s\n", target.c_str());
         return;
     }
-    std::string text = data.get_data_as_string();
-    if (text.empty())
-        return;
-    
-    Json::Reader reader;
-    Json::Value root;
-    if (!reader.parse(text, root)) {
-        std::cout << "Error parsing JSong: " << reader.getFormatedErrorMessages();
-        return;
-    }
-    
-    JSongReader jsong_reader;
-    Pattern block;
-    jsong_reader.build(root, block);
-    if (root.empty())
-        return;
     
-    for (Pattern::iterator iter = block.begin(); iter != block.end();
-         iter++) {
-        Pattern::Event event = iter->second;
-        event.frame += cursor.get_row();
-        event.channel += cursor.get_channel();
+    // offset and clip the block, keeping it sorted by frame
+    int row = cursor.get_row();
+    int channel = cursor.get_channel();
+    PatternEventArray::iterator out = events.begin();
+    for (PatternEventArray::iterator iter = events.begin(); 
+         iter != events.end(); ++iter) {
+        Pattern::Event event = *iter;
+        event.frame += row;
+        event.channel += channel;
         if (event.channel >= pattern->get_channel_count())
             continue; // skip
         if (event.frame >= pattern->get_length())
             continue; // skip
-        pattern->add_event(event);
+        *out++ = event;
     }
+    events.erase(out, events.end());
+    if (!events.empty())
+        pattern->merge_events(&events[0], (int)events.size());
     invalidate();
 }
 
@@ -1290,39 +1420,37 @@ void PatternView::cut_block() {
 }
 
 void PatternView::copy_block() {
-    if (!get_pattern())
+    Pattern *pattern = get_pattern();
+    if (!pattern)
         return;
-    clipboard_jsong = "";
-    Pattern block;
-    block.copy_from(*get_pattern());
-    // clip everything that's not in range
-    for (Pattern::iterator iter = block.begin(); iter != block.end();
-         iter++) {
+    clipboard_block = "";
+    PatternSelection sel(selection);
+    sel.sort();
+    int row0 = sel.p0.get_row();
+    int row1 = sel.p1.get_row();
+    int channel0 = sel.p0.get_channel();
+    
+    // only visit the selected rows
+    PatternEventArray events;
+    Pattern::iterator end = pattern->upper_bound(row1);
+    for (Pattern::iterator iter = pattern->lower_bound(row0); iter != end;
+         ++iter) {
         PatternCursor cur(cursor);
-        cur.set_row(iter->second.frame);
-        cur.set_channel(iter->second.channel);
-        cur.set_param(iter->second.param);
-        if (!selection.in_range(cur)) {
-            iter->second.frame = -1; // clip
-        } else {
-            iter->second.frame -= selection.p0.get_row();
-            iter->second.channel -= selection.p0.get_channel();
-        }
+        cur = iter->second;
+        if (!selection.in_range(cur))
+            continue;
+        Pattern::Event event = iter->second;
+        event.frame -= row0;
+        event.channel -= channel0;
+        events.push_back(event);
     }
-    block.update_keys(); // remove clipped keys
-    int length = selection.p1.get_row() - selection.p0.get_row() + 1;
-    block.set_length(length);
-    
-    JSongWriter jsong_writer;
-    Json::Value root;
-    jsong_writer.collect(root,block);
-    if (root.empty())
+    if (events.empty())
         return;
-    Json::StyledWriter writer;
-    clipboard_jsong = writer.write(root);
+    encode_block(clipboard_block, row1 - row0 + 1, events);
     
     Glib::RefPtr<Gtk::Clipboard> clipboard = Gtk::Clipboard::get();
     std::list<Gtk::TargetEntry> list_targets;
+    list_targets.push_back(Gtk::TargetEntry(TargetFormatPatternBinary));
     list_targets.push_back(Gtk::TargetEntry(TargetFormatPattern));
     clipboard->set(list_targets,
         sigc::mem_fun(*this, &PatternView::on_clipboard_get),
@@ -1332,7 +1460,7 @@ void PatternView::copy_block() {
 
 void PatternView::paste_block() {
     Glib::RefPtr<Gtk::Clipboard> clipboard = Gtk::Clipboard::get();
-    clipboard->request_contents(TargetFormatPattern,
+    clipboard->request_contents(TargetFormatPatternBinary,
         sigc::mem_fun(*this, &PatternView::on_clipboard_received));
 }
 
@@ -1514,8 +1642,10 @@ bool PatternView::on_key_press_event(GdkEventKey* event) {
                         evt.sanitize_value();
                         if (evt.is_valid())
                             get_pattern()->add_event(evt);
-                        else if (i != get_pattern()->end())
+                        else if (i != get_pattern()->end()) {
                             get_pattern()->erase(i);
+                            get_pattern()->touch();
+                        }
                         invalidate_cursor();
                         return true;
                     }
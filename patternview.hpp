@@ -229,6 +229,7 @@ public:
 
     void set_cursor(const PatternCursor &cursor, bool select=false);
     void set_cursor(int x, int y);
+    const PatternCursor &get_cursor() const;
 
     Glib::RefPtr<Gdk::GC> gc;
     Glib::RefPtr<Gdk::GC> xor_gc;
@@ -325,7 +326,8 @@ protected:
     Gtk::Adjustment *vadjustment;
     PatternCursor cursor;
     PatternSelection selection;
-    std::string clipboard_jsong;
+    // binary block, see encode_block()
+    std::string clipboard_block;
 
     typedef std::vector<CellRenderer *> CellRendererArray;
 
@@ -2,15 +2,83 @@
 #include "player.hpp"
 #include "model.hpp"
 
+#include <cmath>
+
+#if !defined(M_PI)
+#define M_PI 3.14159265358979323846
+#endif
+
 namespace Jacker {
 
 enum {
-    // how many messages can be buffered?
+    // how many messages can be buffered at first?
     MaxMessageCount = 1024,
+    // how many messages can be buffered at most? more than
+    // a frame of every track and channel takes.
+    MaxQueueCapacity = 65536,
     // how many samples should be pre-mixed
     PreMixSize = 44100,
+    // the queues grow when they fill up before that many samples
+    // are pre-mixed, as mixing happens every 100 ms
+    MinPreMixSize = PreMixSize / 4,
+    // how many incoming messages can be buffered for recording
+    MaxRecordEventCount = 1024,
+    // how many frames update_checkpoints() scans per call
+    CheckpointScanFrames = 4096,
+    // midi channels per port
+    MIDIChannelCount = 16,
+    // how many values ramps send per frame by default, and at most
+    DefaultRampSteps = 16,
+    MaxRampSteps = 64,
+    // how many messages a channel command sends at most
+    MaxCommandMessages = 16,
 };
 
+// index of the lowest set bit, bits must not be 0
+static inline int lowest_bit(unsigned int bits) {
+#if defined(__GNUC__)
+    return __builtin_ctz(bits);
+#else
+    int index = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+// bandwidth of the clock follower in Hz, lower values filter
+// more jitter but follow tempo changes slower
+static const double ClockBandwidth = 0.5;
+
+// maps a 7-bit pitch wheel value from a pattern to 14 bits,
+// keeping 0x40 in the center
+static int wheel_value(int value) {
+    if (value < 0x40)
+        return value << 7;
+    return 0x2000 + (value - 0x40) * 0x1fff / 0x3f;
+}
+
+// where a pitch slide takes the wheel from current, 0x80
+// being no change and each step 1/128 of the range
+static int slide_value(int current, int value) {
+    return std::min(std::max(current + (value - 0x80) * 0x40, 0), 0x3fff);
+}
+
+// true for values of a note column that start a note
+static bool is_key(int note) {
+    return (note != ValueNone) && (note != NoteOff);
+}
+
+// xorshift, for the probability command
+static unsigned int next_random(unsigned int &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
 //=============================================================================
 
 Message::Message() {
@@ -22,6 +90,10 @@ Message::Message() {
     port = 0;
 }
 
+void Message::set_timestamp(long long samples) {
+    timestamp = (int)(unsigned int)(samples >> 24);
+}
+
 //=============================================================================
 
 MessageQueue::MessageQueue()
@@ -29,6 +101,8 @@ MessageQueue::MessageQueue()
     write_samples = 0;
     position = 0;
     read_samples = 0;
+    lookahead = 0;
+    splice = false;
     model = NULL;
 }
 
@@ -36,21 +110,27 @@ void MessageQueue::set_model(Model &model) {
     this->model = &model;
 }
 
-void MessageQueue::init_message(int bus, Message &msg) {
+long long MessageQueue::get_timestamp(const Message &msg) const {
+    long long base = read_samples;
+    int delta = (int)((unsigned int)msg.timestamp - (unsigned int)(base >> 24));
+    return ((base >> 24) << 24) + ((long long)delta << 24);
+}
+
+void MessageQueue::init_message(int bus, Message &msg, long long offset) {
     assert(model);
-    msg.timestamp = write_samples;
+    msg.set_timestamp(write_samples + offset);
     msg.frame = position;
     msg.port = model->tracks[bus].midi_port;
 }
 
-void MessageQueue::on_cc(int bus, int ccindex, int ccvalue) {
+void MessageQueue::on_cc(int bus, int ccindex, int ccvalue, long long offset) {
     if (ccindex == ValueNone)
         return;
     if (ccvalue == ValueNone)
         return;
     assert(model);
     Message msg;
-    init_message(bus,msg);
+    init_message(bus,msg,offset);
     msg.type = Message::TypeMIDI;
     msg.bus = bus;
     msg.command = MIDI::CommandControlChange;
@@ -60,6 +140,19 @@ void MessageQueue::on_cc(int bus, int ccindex, int ccvalue) {
     push(msg);
 }
 
+void MessageQueue::on_pitch_wheel(int bus, int value, long long offset) {
+    assert(model);
+    Message msg;
+    init_message(bus,msg,offset);
+    msg.type = Message::TypeMIDI;
+    msg.bus = bus;
+    msg.command = MIDI::CommandPitchWheel;
+    msg.channel = model->tracks[bus].midi_channel;
+    msg.data1 = value & 0x7f;
+    msg.data2 = (value >> 7) & 0x7f;
+    push(msg);
+}
+
 void MessageQueue::on_command(int bus, int channel, Message::Type command, int value, int value2, int value3) {
     if (value == ValueNone)
         return;
@@ -80,8 +173,13 @@ void MessageQueue::on_command(int bus, int channel, Message::Type command, int v
 }
 
 void MessageQueue::on_note(int bus, int channel, int note, int velocity) {
-    assert(model);
     Message msg;
+    if (init_note(bus, channel, note, velocity, msg))
+        push(msg);
+}
+
+bool MessageQueue::init_note(int bus, int channel, int note, int velocity, Message &msg) {
+    assert(model);
     init_message(bus,msg);
     msg.type = Message::TypeMIDI;
     msg.bus = bus;
@@ -93,7 +191,7 @@ void MessageQueue::on_note(int bus, int channel, int note, int velocity) {
         msg.data2 = 0;
     } else if (note == ValueNone) {
         if (velocity == ValueNone)
-            return;
+            return false;
         // aftertouch
         msg.command = MIDI::CommandAftertouch;
         msg.data1 = 0;
@@ -105,17 +203,55 @@ void MessageQueue::on_note(int bus, int channel, int note, int velocity) {
         msg.data1 = note;
         msg.data2 = velocity;
     }
+    return true;
+}
+
+void MessageQueue::stop_notes(int bus) {
+    Message msg;
+    if (bus == ValueNone) {
+        msg.set_timestamp(write_samples);
+        msg.frame = position;
+    } else {
+        init_message(bus,msg);
+    }
+    msg.type = Message::TypeNotesOff;
+    msg.bus = bus;
     push(msg);
 }
 
-void MessageQueue::all_notes_off(int bus) {
-    on_cc(bus, MIDI::ControllerAllNotesOff, 0);
+void MessageQueue::reset_channels(int bus) {
+    Message msg;
+    init_message(bus,msg);
+    msg.type = Message::TypeChannelReset;
+    msg.bus = bus;
+    push(msg);
+}
+
+void MessageQueue::on_system(int port, int status, int data1, int data2) {
+    Message msg;
+    msg.set_timestamp(write_samples);
+    msg.frame = position;
+    msg.bus = ValueNone;
+    msg.port = port;
+    msg.type = Message::TypeMIDI;
+    msg.status = status;
+    msg.data1 = data1;
+    msg.data2 = data2;
+    push(msg);
+}
+
+void MessageQueue::on_song_position(int port, int position) {
+    assert(model);
+    // in sixteenth notes
+    int beats = std::min(position * 4 / model->frames_per_beat, 0x3fff);
+    on_system(port, MIDI::StatusSongPosition, beats & 0x7f, beats >> 7);
 }
 
-void MessageQueue::status_msg() {
+void MessageQueue::status_msg(int step) {
     Message msg;
     init_message(0,msg);
     msg.type = Message::TypeEmpty;
+    msg.data = step;
     push(msg);
 }
 
@@ -126,9 +262,37 @@ Player::Channel::Channel() {
     volume = 1.0f;
 }
 
+//=============================================================================
+
+Player::NoteSet::NoteSet() {
+    clear();
+}
+
+void Player::NoteSet::set(int key) {
+    bits[key >> 5] |= 1u << (key & 31);
+}
+
+void Player::NoteSet::reset(int key) {
+    bits[key >> 5] &= ~(1u << (key & 31));
+}
+
+void Player::NoteSet::clear() {
+    bits[0] = bits[1] = bits[2] = bits[3] = 0;
+}
+
+int Player::NoteSet::first() const {
+    for (int i = 0; i < 4; ++i) {
+        if (bits[i])
+            return (i << 5) + lowest_bit(bits[i]);
+    }
+    return -1;
+}
+
 //=============================================================================
     
 Player::Bus::Bus() {
+    port = 0;
+    midi_channel = 0;
     channels.resize(MaxChannels);
     notes.resize(128);
     for (NoteArray::iterator iter = notes.begin(); 
@@ -139,13 +303,297 @@ Player::Bus::Bus() {
 
 //=============================================================================
 
-Player::Player() {
+Player::ChaseState::ChaseState() {
+    tempo = ValueNone;
+}
+
+void Player::ChaseState::clear() {
+    tempo = ValueNone;
+    values.clear();
+}
+
+void Player::ChaseState::set(int kind, int bus, int index, int value) {
+    values[make_key(kind, bus, index)] = value;
+}
+
+int Player::ChaseState::make_key(int kind, int bus, int index) {
+    // sorted by bus, so resets and values of a bus go out together
+    return (bus << 16) | (kind << 8) | index;
+}
+
+void Player::ChaseState::split_key(int key, int &kind, int &bus, int &index) {
+    bus = key >> 16;
+    kind = (key >> 8) & 0xff;
+    index = key & 0xff;
+}
+
+//=============================================================================
+
+Player::Ramps::Ramps() {
+    count = 0;
+    values.resize(MaxTracks * ControllerCount, ValueNone);
+}
+
+void Player::Ramps::reset(const ChaseState &state) {
+    count = 0;
+    std::fill(values.begin(), values.end(), (short)ValueNone);
+    std::map<int,int>::const_iterator iter;
+    for (iter = state.values.begin(); iter != state.values.end(); ++iter) {
+        int kind, bus, index;
+        ChaseState::split_key(iter->first, kind, bus, index);
+        if (bus >= MaxTracks)
+            continue;
+        if (kind == ChaseState::KeyCC)
+            values[bus * ControllerCount + index] = iter->second;
+        else if (kind == ChaseState::KeyPitchWheel)
+            values[bus * ControllerCount + PitchWheel] = iter->second;
+    }
+}
+
+void Player::Ramps::save(std::vector<State> &states) const {
+    for (int i = 0; i < count; ++i) {
+        State state;
+        state.bus = bus[i];
+        state.controller = controller[i];
+        state.from = from[i];
+        state.delta = delta[i];
+        state.rate = rate[i];
+        state.elapsed = elapsed[i];
+        state.remaining = remaining[i];
+        states.push_back(state);
+    }
+}
+
+void Player::Ramps::restore(const ChaseState &state, const std::vector<State> &states) {
+    reset(state);
+    for (size_t i = 0; (i < states.size()) && (count < MaxRamps); ++i) {
+        const State &ramp = states[i];
+        bus[count] = ramp.bus;
+        controller[count] = ramp.controller;
+        from[count] = ramp.from;
+        delta[count] = ramp.delta;
+        rate[count] = ramp.rate;
+        elapsed[count] = ramp.elapsed;
+        remaining[count] = ramp.remaining;
+        // what the last frame ended with
+        float t = std::min(ramp.elapsed * ramp.rate, 1.0f);
+        output[count] = (int)(ramp.from + ramp.delta * t + 0.5f);
+        values[ramp.bus * ControllerCount + ramp.controller] = output[count];
+        count++;
+    }
+}
+
+int Player::Ramps::get_value(int bus, int controller) const {
+    return values[bus * ControllerCount + controller];
+}
+
+void Player::Ramps::set_value(int bus, int controller, int value) {
+    values[bus * ControllerCount + controller] = value;
+    for (int i = 0; i < count; ++i) {
+        if ((this->bus[i] == bus) && (this->controller[i] == controller)) {
+            // the ramp ends right away
+            remaining[i] = 0;
+            from[i] = (float)value;
+            delta[i] = 0.0f;
+        }
+    }
+}
+
+bool Player::Ramps::start(int bus, int controller, int value, int frames) {
+    int current = get_value(bus, controller);
+    if ((frames <= 0) || (current == ValueNone))
+        return false;
+    int index = 0;
+    while ((index < count) && 
+        ((this->bus[index] != bus) || (this->controller[index] != controller))) {
+        index++;
+    }
+    if (index == MaxRamps)
+        return false;
+    if (index == count)
+        count++;
+    this->bus[index] = bus;
+    this->controller[index] = controller;
+    from[index] = (float)current;
+    delta[index] = (float)(value - current);
+    rate[index] = 1.0f / (float)frames;
+    elapsed[index] = 0.0f;
+    remaining[index] = frames;
+    output[index] = current;
+    return true;
+}
+
+void Player::Ramps::compute(float position) {
+    for (int i = 0; i < count; ++i) {
+        float t = std::min((elapsed[i] + position) * rate[i], 1.0f);
+        output[i] = (int)(from[i] + delta[i] * t + 0.5f);
+    }
+}
+
+bool Player::Ramps::changed(int index) {
+    short &value = values[bus[index] * ControllerCount + controller[index]];
+    if (value == output[index])
+        return false;
+    value = output[index];
+    return true;
+}
+
+void Player::Ramps::next_frame() {
+    int kept = 0;
+    for (int i = 0; i < count; ++i) {
+        if (!remaining[i])
+            continue;
+        bus[kept] = bus[i];
+        controller[kept] = controller[i];
+        from[kept] = from[i];
+        delta[kept] = delta[i];
+        rate[kept] = rate[i];
+        elapsed[kept] = elapsed[i] + 1.0f;
+        remaining[kept] = remaining[i] - 1;
+        output[kept] = output[i];
+        kept++;
+    }
+    count = kept;
+}
+
+//=============================================================================
+
+bool Player::Jump::operator ==(const Jump &other) const {
+    return (begin == other.begin) && (end == other.end);
+}
+
+//=============================================================================
+
+ClockFollower::ClockFollower() {
+    sample_rate = 44100;
+    reset();
+}
+
+void ClockFollower::reset() {
+    running = false;
+    tick_count = 0;
+    position = -1;
+    t0 = t1 = 0.0;
+    // 120 bpm
+    tick_size = (double)sample_rate * 60.0 / (120.0 * TicksPerBeat);
+}
+
+void ClockFollower::set_sample_rate(int sample_rate) {
+    this->sample_rate = sample_rate;
+    reset();
+}
+
+void ClockFollower::tick(long long time) {
+    if (!running)
+        return;
+    position++;
+    double t = (double)time;
+    if (!tick_count) {
+        t0 = t;
+        t1 = t + tick_size;
+    } else {
+        // second order DLL
+        double omega = 2.0 * M_PI * ClockBandwidth * tick_size / (double)sample_rate;
+        double b = sqrt(2.0) * omega;
+        double c = omega * omega;
+        double e = t - t1;
+        t0 = t1;
+        t1 += b * e + tick_size;
+        tick_size = tick_size + c * e;
+    }
+    tick_count++;
+}
+
+void ClockFollower::start() {
+    position = -1;
+    resume();
+}
+
+void ClockFollower::resume() {
+    running = true;
+    tick_count = 0;
+}
+
+void ClockFollower::stop() {
+    running = false;
+}
+
+void ClockFollower::set_song_position(int position) {
+    // a sixteenth note is six ticks, and the next tick is
+    // the one at the position
+    this->position = position * (TicksPerBeat / 4) - 1;
+}
+
+bool ClockFollower::is_running() const {
+    return running;
+}
+
+bool ClockFollower::is_locked() const {
+    return (tick_count >= LockTicks);
+}
+
+double ClockFollower::get_tick_size() const {
+    return tick_size;
+}
+
+double ClockFollower::get_beats_per_minute() const {
+    return (double)sample_rate * 60.0 / (tick_size * TicksPerBeat);
+}
+
+long long ClockFollower::get_frame_size(int frames_per_beat) const {
+    double samples = tick_size * TicksPerBeat / frames_per_beat;
+    return (long long)(samples * 4294967296.0);
+}
+
+int ClockFollower::get_position() const {
+    return position;
+}
+
+int ClockFollower::get_frame(int frames_per_beat) const {
+    return std::max((int)position, 0) * frames_per_beat / TicksPerBeat;
+}
+
+//=============================================================================
+
+Player::Player() 
+    : record_events(MaxRecordEventCount) {
     buses.resize(MaxTracks);
+    port_notes.resize(MaxPorts * MIDIChannelCount);
+    port_latency.resize(MaxPorts, 0);
+    port_advance.resize(MaxPorts, 0);
+    bus_advance.resize(MaxTracks, 0);
+    max_advance = 0;
     model = NULL;
     sample_rate = 44100;
     read_position = 0;
+    read_step = 0;
+    read_frame_samples = 0;
     playing = false;
+    recording = false;
+    clock_port = ValueNone;
+    clock_started = false;
+    cue_ready = false;
+    cue_position = 0;
+    cue_delay = 0;
+    external_frame_size = 0;
+    muted_buses = 0;
+    solo_buses = 0;
+    audible_buses = ~0u;
     front_index = 0;
+    read_index = 0;
+    start_position = 0;
+    start_delay = 0;
+    start_splice = false;
+    mix_step = 0;
+    queue_capacity = MaxMessageCount;
+    capacity_pending = false;
+    queue_high_water = 0;
+    checkpoint_interval = 0;
+    scan_frame = 0;
+    ramp_steps = DefaultRampSteps;
+    frame_messages.reserve(MaxMessageCount);
+    subframe_frame_size = 0;
+    random_state = 0x2545f491;
 }
 
 MessageQueue &Player::get_back() {    
@@ -176,43 +624,174 @@ void Player::stop() {
     if (!playing)
         return;
     playing = false;
-    seek(read_position);
-    for (size_t bus = 0; bus < model->tracks.size(); ++bus) {
-        rt_messages.all_notes_off(bus);
-    }    
+    if (clock_port != ValueNone)
+        rt_messages.on_system(clock_port, MIDI::StatusStop);
+    clock_started = false;
+    restart(read_position, 0, false);
+    rt_messages.stop_notes(ValueNone);
 }
 
 void Player::play() {
     if (playing)
         return;
+    if (start_cued())
+        return;
     playing = true;
-    seek(read_position);
+    restart(read_position, 0, false);
+}
+
+bool Player::is_cued(int position, long long delay) const {
+    return cue_ready && (cue_position == position) && 
+        (cue_delay == delay);
+}
+
+bool Player::start_cued() {
+    if (!cue_ready || playing)
+        return false;
+    cue_ready = false;
+    // the premix already starts the clock
+    clock_started = true;
+    playing = true;
+    return true;
 }
 
 bool Player::is_playing() const {
     return playing;
 }
 
-void Player::premix() {
+void Player::premix(bool restart_clock, long long start, bool splice) {
     MessageQueue &queue = get_back();
-    queue.clear();
-    queue.read_samples = 0;
-    queue.write_samples = 0;
-    mix_events(queue, PreMixSize);// fill buffer
+    int position = queue.position;
+    int tempo = model->beats_per_minute;
+    int step = mix_step;
+    if (restart_clock)
+        grow_queues(get_chase_size(chase_state) + 2);
+    // a splice continues the ramps running at the frame being
+    // read, anything else starts from the chased values
+    std::vector<Ramps::State> ramp_states;
+    if (splice) {
+        while (!ramp_frames.empty() && 
+            ((ramp_frames.back().samples >> 24) >= (start >> 24))) {
+            if ((ramp_frames.back().samples >> 24) == (start >> 24))
+                ramp_states.swap(ramp_frames.back().ramps);
+            ramp_frames.pop_back();
+        }
+    } else {
+        ramp_frames.clear();
+    }
+    size_t ramp_frame_count = ramp_frames.size();
+    do {
+        // the back queue is not read yet, so it can be resized.
+        // start over if the song is too dense for it.
+        capacity_pending = false;
+        if ((int)queue.get_size() != queue_capacity)
+            queue.resize(queue_capacity);
+        queue.clear();
+        queue.position = position;
+        model->beats_per_minute = tempo;
+        mix_step = step;
+        if (splice) {
+            // the realtime thread sets read_samples when it
+            // switches over
+            queue.read_samples = start;
+            queue.write_samples = start;
+        } else {
+            queue.read_samples = 0;
+            queue.write_samples = std::max(start, (long long)0);
+        }
+        queue.splice = splice;
+        queue.lookahead = max_advance;
+        if ((clock_port != ValueNone) && restart_clock) {
+            if (queue.position) {
+                queue.on_song_position(clock_port, queue.position);
+                queue.on_system(clock_port, MIDI::StatusContinue);
+            } else {
+                queue.on_system(clock_port, MIDI::StatusStart);
+            }
+        }
+        if (restart_clock)
+            mix_chase(queue, chase_state);
+        ramp_frames.resize(ramp_frame_count);
+        ramps.restore(chase_state, ramp_states);
+        mix_events(queue, PreMixSize);// fill buffer
+    } while (capacity_pending);
 }
 
 void Player::flush() {
-    seek(read_position);
+    restart(read_position, 0, false);
+}
+
+void Player::seek(int position, long long delay) {
+    restart(position, delay, true);
 }
 
-void Player::seek(int position) {
+void Player::restart(int position, long long delay, bool chase_tempo) {
+    cue_ready = false;
     MessageQueue &queue = get_back();
+    bool jump = playing && clock_started && (position != read_position);
+    // playback that goes on where it is continues from the
+    // frame being read
+    bool splice = playing && clock_started && !jump;
+    long long start = delay;
+    int step = ValueNone;
+    if (splice && !start_splice && (read_index != front_index)) {
+        // the realtime thread has not started on the last premix,
+        // so there is nothing to splice into. premix it again.
+        splice = false;
+        position = start_position;
+        start = start_delay;
+    } else if (splice) {
+        // the frame being read and when it began, taken together
+        do {
+            position = read_position;
+            start = read_frame_samples;
+            step = read_step;
+        } while (position != read_position);
+    }
+    // restart the clock when playback starts or jumps
+    bool restart_clock = !splice;
     queue.position = position;
-    if (playing)
-        premix();
-    else
+    // a step that was not entered yet is looked up again too
+    if ((step < 0) || (step >= (int)jumps.size()) ||
+        (position < jumps[step].begin) || (position >= jumps[step].end))
+        step = find_step(position);
+    mix_step = step;
+    // ramps start from the chased values, even when the
+    // state is not sent again
+    check_checkpoints();
+    get_chase_state(position, chase_state);
+    // only on explicit seeks, so tempo changes made while
+    // stopped or playing are kept
+    if (restart_clock && chase_tempo && !external_frame_size && 
+        (chase_state.tempo != ValueNone))
+        model->beats_per_minute = chase_state.tempo;
+    if (playing) {
+        if ((clock_port != ValueNone) && restart_clock && clock_started)
+            rt_messages.on_system(clock_port, MIDI::StatusStop);
+        clock_started = true;
+        premix(restart_clock, start, splice);
+        start_position = position;
+        start_delay = start;
+        start_splice = splice;
+        flip();
+        // the old queue is done with once the realtime thread
+        // sees this, so nothing it plays is left hanging
+        if (jump)
+            rt_messages.stop_notes(ValueNone);
+    } else {
         read_position = position;
-    flip();
+        if (clock_port != ValueNone)
+            rt_messages.on_song_position(clock_port, position);
+        // premix anyway, so playback can start right away
+        premix(true, delay, false);
+        cue_position = position;
+        cue_delay = delay;
+        start_position = position;
+        start_delay = delay;
+        start_splice = false;
+        flip();
+        cue_ready = true;
+    }
 }
 
 int Player::get_position() const {
@@ -223,7 +802,13 @@ void Player::reset() {
     stop();
 }
 
+void Player::set_frame_size(long long frame_size) {
+    external_frame_size = frame_size;
+}
+
 long long Player::get_frame_size() {
+    if (external_frame_size)
+        return external_frame_size;
     return ((long long)(sample_rate*60)<<32)/
            (model->frames_per_beat * model->beats_per_minute);    
 }
@@ -238,7 +823,397 @@ void Player::play_event(int track, const class PatternEvent &event) {
 }
 
 void Player::stop_events(int track) {
-    rt_messages.all_notes_off(track);
+    rt_messages.stop_notes(track);
+}
+
+int Player::find_step(int position) const {
+    if (!jumps.empty() && (position < jumps[0].begin))
+        return 0;
+    for (size_t step = 0; step < jumps.size(); ++step) {
+        if ((position >= jumps[step].begin) && (position < jumps[step].end))
+            return (int)step;
+    }
+    return (int)jumps.size();
+}
+
+void Player::update_playlist() {
+    assert(model);
+    JumpArray table;
+    if (model->enable_playlist) {
+        for (size_t i = 0; i < model->playlist.size(); ++i) {
+            const PlaylistEntry &entry = model->playlist[i];
+            if ((entry.region < 0) || (entry.region >= (int)model->regions.size()))
+                continue;
+            const Region &region = model->regions[entry.region];
+            if (region.end <= region.begin)
+                continue;
+            Jump jump;
+            jump.begin = region.begin;
+            jump.end = region.end;
+            for (int count = 0; count < std::max(entry.repeat, 1); ++count) {
+                table.push_back(jump);
+            }
+        }
+    }
+    if (table == jumps)
+        return;
+    jumps = table;
+    flush();
+}
+
+void Player::update_mute() {
+    assert(model);
+    unsigned int muted = 0;
+    unsigned int solo = 0;
+    for (size_t bus = 0; bus < model->tracks.size(); ++bus) {
+        const Track &track = model->tracks[bus];
+        if (track.mute)
+            muted |= 1u << bus;
+        if (track.solo)
+            solo |= 1u << bus;
+    }
+    solo_buses = solo;
+    muted_buses = muted;
+}
+
+void Player::set_recording(bool enable) {
+    recording = enable;
+}
+
+bool Player::is_recording() const {
+    return recording;
+}
+
+void Player::record_message(int offset, const MIDI::Message &msg) {
+    if (!recording || !playing)
+        return;
+    if (record_events.full())
+        return; // drop
+    MessageQueue &queue = get_front();
+    long long framesize = get_frame_size();
+    // time passed since the start of the current frame
+    long long delta = queue.read_samples + ((long long)offset<<32) 
+        - read_frame_samples;
+    // frames are read ahead with latency compensation, so the
+    // message may belong to a frame before read_position
+    int frames = (int)(delta / framesize);
+    if (delta < 0)
+        frames = -(int)((framesize - 1 - delta) / framesize);
+    delta -= (long long)frames * framesize;
+    RecordEvent event;
+    event.frame = std::max(read_position + frames, 0);
+    event.subframe = (int)((delta << 8) / framesize);
+    event.msg = msg;
+    record_events.push(event);
+}
+
+void Player::set_clock_port(int port) {
+    clock_port = port;
+}
+
+int Player::get_clock_port() const {
+    return clock_port;
+}
+
+void Player::set_ramp_steps(int steps) {
+    ramp_steps = std::min(std::max(steps, 1), (int)MaxRampSteps);
+}
+
+int Player::get_ramp_steps() const {
+    return ramp_steps;
+}
+
+float Player::get_queue_fill() {
+    MessageQueue &queue = get_front();
+    return (float)queue.get_read_size() / (float)queue.get_size();
+}
+
+int Player::get_premix_ahead() {
+    MessageQueue &queue = get_front();
+    return (int)((queue.write_samples - queue.read_samples) >> 32);
+}
+
+int Player::get_queue_high_water() const {
+    return queue_high_water;
+}
+
+int Player::get_queue_capacity() const {
+    return queue_capacity;
+}
+
+void Player::grow_queues(int count) {
+    int capacity = queue_capacity;
+    while ((capacity < MaxQueueCapacity) && (capacity <= count * 2)) {
+        capacity *= 2;
+    }
+    capacity = std::min(capacity, (int)MaxQueueCapacity);
+    if (capacity == queue_capacity)
+        return;
+    printf("Player: premix queues grow to %i messages\n", capacity);
+    queue_capacity = capacity;
+    capacity_pending = true;
+}
+
+void Player::set_port_latency(int port, int samples) {
+    if ((port < 0) || (port >= (int)port_latency.size()))
+        return;
+    port_latency[port] = std::max(samples, 0);
+}
+
+bool Player::update_latency() {
+    assert(model);
+    bool changed = false;
+    long long advance_max = 0;
+    for (size_t port = 0; port < port_advance.size(); ++port) {
+        long long advance = (long long)port_latency[port] << 32;
+        if (advance != port_advance[port]) {
+            port_advance[port] = advance;
+            changed = true;
+        }
+        advance_max = std::max(advance_max, advance);
+    }
+    for (size_t bus = 0; bus < bus_advance.size(); ++bus) {
+        long long advance = 0;
+        if (bus < model->tracks.size()) {
+            const Track &track = model->tracks[bus];
+            int samples = track.latency * sample_rate / 1000;
+            if ((track.midi_port >= 0) && (track.midi_port < (int)port_latency.size()))
+                samples += port_latency[track.midi_port];
+            advance = (long long)std::max(samples, 0) << 32;
+        }
+        if (advance != bus_advance[bus]) {
+            bus_advance[bus] = advance;
+            changed = true;
+        }
+        advance_max = std::max(advance_max, advance);
+    }
+    if (!changed)
+        return false;
+    max_advance = advance_max;
+    flush();
+    return true;
+}
+
+long long Player::get_advance(const Message &msg) const {
+    if (msg.bus == ValueNone)
+        return port_advance[msg.port];
+    return bus_advance[msg.bus];
+}
+
+void Player::update_checkpoints() {
+    assert(model);
+    int interval = std::max(model->get_frames_per_bar(), 1);
+    if (interval != checkpoint_interval) {
+        checkpoints.clear();
+        checkpoint_interval = interval;
+        scan_frame = 0;
+        scan_state.clear();
+    }
+    check_checkpoints();
+    int song_end = model->get_song_end();
+    for (int frames = 0; frames < CheckpointScanFrames; frames += interval) {
+        size_t index = scan_frame / interval;
+        checkpoints.resize(index + 1);
+        checkpoints[index] = scan_state;
+        // positions past the end chase from the last one
+        if (scan_frame >= song_end)
+            return;
+        // patterns are not decoded here, that is left to
+        // playback. the scan goes on once they are.
+        if (!chase_frames(scan_state, scan_frame, scan_frame + interval, false))
+            return;
+        scan_frame += interval;
+    }
+}
+
+void Player::invalidate_checkpoints(int frame) {
+    if (!checkpoint_interval)
+        return;
+    // the state at the start of the bar is unaffected
+    size_t index = std::max(frame, 0) / checkpoint_interval;
+    if (index >= checkpoints.size())
+        return;
+    checkpoints.resize(index + 1);
+    scan_frame = (int)index * checkpoint_interval;
+    scan_state = checkpoints[index];
+}
+
+void Player::check_checkpoints() {
+    assert(model);
+    // revisions of the decoded patterns, changed ones keep the
+    // old revision in the map until the song is walked
+    std::map<const Pattern *, long long> revisions;
+    for (PatternList::iterator iter = model->patterns.begin();
+         iter != model->patterns.end(); ++iter) {
+        if ((*iter)->is_loaded())
+            revisions[*iter] = (*iter)->get_revision();
+    }
+    int frame = ValueNone;
+    size_t index = 0;
+    for (Song::iterator iter = model->song.begin(); 
+         iter != model->song.end(); ++iter, ++index) {
+        Song::Event &event = iter->second;
+        if (index < checkpoint_events.size()) {
+            ChaseSource &source = checkpoint_events[index];
+            if ((source.frame != event.frame) || (source.track != event.track) ||
+                (source.length != event.length) || (source.pattern != event.pattern)) {
+                frame = std::min(source.frame, event.frame);
+                break;
+            }
+        } else {
+            frame = event.frame;
+            break;
+        }
+        std::map<const Pattern *, long long>::iterator old_revision =
+            checkpoint_revisions.find(event.pattern);
+        std::map<const Pattern *, long long>::iterator new_revision =
+            revisions.find(event.pattern);
+        if ((old_revision != checkpoint_revisions.end()) && 
+            (new_revision != revisions.end()) &&
+            (old_revision->second != new_revision->second)) {
+            frame = event.frame;
+            break;
+        }
+    }
+    if ((frame == ValueNone) && (index < checkpoint_events.size()))
+        frame = checkpoint_events[index].frame; // events were removed
+    checkpoint_revisions.swap(revisions);
+    if (frame == ValueNone)
+        return;
+    invalidate_checkpoints(frame);
+    checkpoint_events.clear();
+    for (Song::iterator iter = model->song.begin(); 
+         iter != model->song.end(); ++iter) {
+        ChaseSource source;
+        source.frame = iter->second.frame;
+        source.track = iter->second.track;
+        source.length = iter->second.length;
+        source.pattern = iter->second.pattern;
+        checkpoint_events.push_back(source);
+    }
+}
+
+void Player::get_chase_state(int position, ChaseState &state) {
+    assert(model);
+    state.clear();
+    int frame = 0;
+    if (!checkpoints.empty() && 
+        (checkpoint_interval == std::max(model->get_frames_per_bar(), 1))) {
+        size_t index = std::min((size_t)(std::max(position, 0) / checkpoint_interval),
+                                checkpoints.size() - 1);
+        state = checkpoints[index];
+        frame = (int)index * checkpoint_interval;
+    }
+    // at most one bar, unless the checkpoints are not there yet
+    chase_frames(state, frame, position);
+}
+
+bool Player::chase_frames(ChaseState &state, int begin, int end, bool load) {
+    assert(model);
+    if (begin >= end)
+        return true;
+    
+    // song events in the range, each with an iterator
+    // into its pattern
+    std::vector<Song::Event *> events;
+    std::vector<Pattern::iterator> rows;
+    for (Song::iterator iter = model->song.begin(); 
+         iter != model->song.end(); ++iter) {
+        Song::Event &event = iter->second;
+        if (event.frame >= end)
+            break;
+        if (event.get_end() <= begin)
+            continue;
+        if (!load && !event.pattern->is_loaded())
+            return false;
+        event.pattern->load();
+        events.push_back(&event);
+        rows.push_back(event.pattern->lower_bound(
+            event.get_pattern_frame(std::max(begin, event.frame))));
+    }
+    if (events.empty())
+        return true;
+    
+    Pattern::Row row;
+    for (int frame = begin; frame < end; ++frame) {
+        for (size_t i = 0; i < events.size(); ++i) {
+            Song::Event &event = *events[i];
+            if ((frame < event.frame) || (frame >= event.get_end()))
+                continue;
+            Pattern &pattern = *event.pattern;
+            int pattern_frame = event.get_pattern_frame(frame);
+            if (!pattern_frame)
+                rows[i] = pattern.begin(); // the pattern repeats
+            pattern.collect_events(pattern_frame, rows[i], row);
+            for (int channel = 0; channel < pattern.get_channel_count(); ++channel) {
+                int command = row.get_value(channel, ParamCommand);
+                int ccindex = row.get_value(channel, ParamCCIndex);
+                int ccvalue = row.get_value(channel, ParamCCValue);
+                if (command == Message::TypeCommandPitchWheel) {
+                    // ramps count as having reached their value
+                    if (ccvalue != ValueNone)
+                        state.set(ChaseState::KeyPitchWheel, event.track, 0,
+                            wheel_value(ccvalue));
+                    continue;
+                }
+                if (command != ValueNone) {
+                    int value = row.get_value(channel, ParamValue);
+                    if (value == ValueNone) {
+                        // no change
+                    } else if (command == Message::TypeCommandTempo) {
+                        state.tempo = std::max(1,value);
+                    } else if (command == Message::TypeCommandChannelVolume) {
+                        state.set(ChaseState::KeyVolume, event.track, channel, value);
+                    } else if (command == Message::TypeCommandPitchSlide) {
+                        // relative to the wheel, which starts centered
+                        std::map<int,int>::iterator wheel = state.values.find(
+                            ChaseState::make_key(ChaseState::KeyPitchWheel, event.track, 0));
+                        int current = 0x2000;
+                        if (wheel != state.values.end())
+                            current = wheel->second;
+                        state.set(ChaseState::KeyPitchWheel, event.track, 0,
+                            slide_value(current, value));
+                    }
+                }
+                if ((ccindex != ValueNone) && (ccvalue != ValueNone))
+                    state.set(ChaseState::KeyCC, event.track, ccindex, ccvalue);
+            }
+        }
+    }
+    return true;
+}
+
+void Player::mix_chase(MessageQueue &queue, const ChaseState &state) {
+    assert(model);
+    for (size_t bus = 0; bus < model->tracks.size(); ++bus) {
+        queue.reset_channels(bus);
+    }
+    std::map<int,int>::const_iterator iter;
+    for (iter = state.values.begin(); iter != state.values.end(); ++iter) {
+        int kind, bus, index;
+        ChaseState::split_key(iter->first, kind, bus, index);
+        if (bus >= (int)model->tracks.size())
+            continue;
+        if (kind == ChaseState::KeyVolume) {
+            queue.on_command(bus, index, Message::TypeCommandChannelVolume,
+                iter->second, ValueNone, ValueNone);
+        } else if (kind == ChaseState::KeyPitchWheel) {
+            queue.on_pitch_wheel(bus, iter->second);
+        } else {
+            queue.on_cc(bus, index, iter->second);
+        }
+    }
+}
+
+bool Player::pop_record_event(RecordEvent &event) {
+    if (record_events.empty())
+        return false;
+    event = record_events.pop();
+    return true;
+}
+
+int Player::get_chase_size(const ChaseState &state) const {
+    return (int)(model->tracks.size() + state.values.size());
 }
 
 void Player::mix_events(MessageQueue &queue, int samples) {
@@ -247,70 +1222,405 @@ void Player::mix_events(MessageQueue &queue, int samples) {
     long long target = queue.read_samples + ((long long)samples<<32);
     while (queue.write_samples < target)
     {
-        // send status package
-        queue.status_msg();
-        mix_frame(queue);
+        // clock ticks, and the chased state when the loop jumps
+        int reserve = 0;
+        if (clock_port != ValueNone)
+            reserve += ClockTicksPerBeat + 1;
+        // where the next frame is if not after this one
+        int target = ValueNone;
+        int next_step = mix_step;
+        if (mix_step < (int)jumps.size()) {
+            if ((queue.position + 1) == jumps[mix_step].end) {
+                // the song plays on after the last step
+                next_step++;
+                if (next_step < (int)jumps.size())
+                    target = jumps[next_step].begin;
+            }
+        } else if (model->enable_loop && 
+            ((queue.position + 1) == model->loop.get_end())) {
+            target = model->loop.get_begin();
+        }
+        bool loop_end = (target != ValueNone) && (target != (queue.position + 1));
+        if (loop_end) {
+            // the loop jumps back, so stop notes and chase as
+            // after a seek
+            get_chase_state(target, loop_state);
+            reserve += (int)model->tracks.size() + get_chase_size(loop_state);
+        }
+        if (ramps.count) {
+            ramp_frames.push_back(RampFrame());
+            ramp_frames.back().samples = queue.write_samples;
+            ramps.save(ramp_frames.back().ramps);
+        }
+        int needed = mix_frame(queue, reserve);
+        if (needed) {
+            if (ramps.count)
+                ramp_frames.pop_back();
+            // the queue is full, continue here once the reader
+            // made room. grow the queues if the frame could never
+            // fit or too little is premixed to bridge mixes.
+            long long ahead = queue.write_samples - queue.read_samples;
+            if ((needed >= (int)queue.get_size()) || 
+                (ahead < ((long long)MinPreMixSize << 32)))
+                grow_queues(needed);
+            break;
+        }
         long long framesize = get_frame_size();
+        mix_steps(queue, framesize);
         queue.write_samples += framesize;
         queue.position++;
-        if (model->enable_loop && (queue.position == model->loop.get_end())) {
-            queue.position = model->loop.get_begin();
+        mix_step = next_step;
+        if (loop_end) {
+            queue.position = target;
+            if (clock_port != ValueNone)
+                queue.on_song_position(clock_port, queue.position);
+            // per bus, so the note offs keep the latency of the
+            // notes of the bus
+            for (size_t bus = 0; bus < model->tracks.size(); ++bus) {
+                queue.stop_notes(bus);
+            }
+            mix_chase(queue, loop_state);
+            ramps.reset(loop_state);
         }
     }
+    queue_high_water = std::max(queue_high_water, (int)queue.get_read_size());
 }
 
 void Player::mix() {
     if (!playing)
         return;
+    if (capacity_pending) {
+        // premixes again into a larger queue
+        flush();
+        return;
+    }
+    if (read_index == front_index) {
+        // the reader is on this queue, so frames before the
+        // one it reads are not spliced into anymore
+        long long reading = read_frame_samples >> 24;
+        while (!ramp_frames.empty() && 
+            ((ramp_frames.front().samples >> 24) < reading))
+            ramp_frames.pop_front();
+    }
     mix_events(get_front(), PreMixSize);
 }
 
-void Player::mix_frame(MessageQueue &queue) {
+// commands without a handler are ignored
+template<int C> struct CommandDispatch {
+    static void run(Player &, MessageQueue &, Player::ChannelRow &) {}
+};
+
+#define COMMAND(C, HANDLER) \
+    template<> struct CommandDispatch<C> { \
+        static void run(Player &player, MessageQueue &queue, Player::ChannelRow &row) { \
+            player.HANDLER(queue, row); \
+        } \
+    };
+
+COMMAND('A', command_arpeggio)
+COMMAND('C', command_note_cut)
+COMMAND('D', command_note_delay)
+COMMAND('P', command_probability)
+COMMAND('Q', command_retrigger)
+COMMAND('R', command_ramp)
+COMMAND('S', command_pitch_slide)
+COMMAND('T', command_tempo)
+COMMAND('V', command_channel_volume)
+COMMAND('W', command_pitch_wheel)
+
+#undef COMMAND
+
+typedef void (*CommandFunc)(Player &, MessageQueue &, Player::ChannelRow &);
+
+#define DISPATCH(C) &CommandDispatch<(C)>::run
+#define DISPATCH4(C) DISPATCH(C), DISPATCH(C+1), DISPATCH(C+2), DISPATCH(C+3)
+#define DISPATCH16(C) DISPATCH4(C), DISPATCH4(C+4), DISPATCH4(C+8), DISPATCH4(C+12)
+
+// handlers by command character, filled in at compile time
+// so a row costs one indirect call per command
+static const CommandFunc command_table[0x80] = {
+    DISPATCH16(0x00), DISPATCH16(0x10), DISPATCH16(0x20), DISPATCH16(0x30),
+    DISPATCH16(0x40), DISPATCH16(0x50), DISPATCH16(0x60), DISPATCH16(0x70),
+};
+
+#undef DISPATCH16
+#undef DISPATCH4
+#undef DISPATCH
+
+int Player::mix_frame(MessageQueue &queue, int reserve) {
     assert(model);
     
     Song::IterList events;
     model->song.find_events(queue.position, events);
-    if (events.empty())
-        return;
     
+    // collect all rows first, a frame goes into the queue
+    // as a whole or not at all
+    std::vector<Pattern::Row> rows(events.size());
+    int count = 1 + reserve;
+    // ramps running and starting in this frame
+    int ramp_count = ramps.count;
     Song::IterList::iterator iter;
-    for (iter = events.begin(); iter != events.end(); ++iter) {
+    size_t index = 0;
+    for (iter = events.begin(); iter != events.end(); ++iter, ++index) {
         Song::Event &event = (*iter)->second;
         Pattern &pattern = *event.pattern;
-        
-        if (model->tracks[event.track].mute)
-            continue; // ignore event
-        
-        Pattern::iterator row_iter = pattern.begin();
-        Pattern::Row row;
-        pattern.collect_events(queue.position - event.frame, row_iter, row);
-        
-        // first run: process all cc events
+        // the pattern repeats in events longer than it
+        int pattern_frame = event.get_pattern_frame(queue.position);
+        pattern.load();
+        Pattern::iterator row_iter = pattern.lower_bound(pattern_frame);
+        Pattern::Row &row = rows[index];
+        pattern.collect_events(pattern_frame, row_iter, row);
+        // every message needs at least one value
+        for (Pattern::Row::iterator value = row.begin(); value != row.end(); ++value) {
+            if (*value)
+                count++;
+        }
         for (int channel = 0; channel < pattern.get_channel_count(); ++channel) {
             int command = row.get_value(channel, ParamCommand);
-            int ccindex = row.get_value(channel, ParamCCIndex);
-            int ccvalue = row.get_value(channel, ParamCCValue);
-            if (command != ValueNone) {
-                int value = row.get_value(channel, ParamValue);
-                if (command == Message::TypeCommandTempo) {
-                    if (value != ValueNone)
-                        model->beats_per_minute = std::max(1,value);
-                } else {
-                    queue.on_command(event.track, channel, (Message::Type)command, 
-                    value, ccindex, ccvalue);
-                }
-            }
-            queue.on_cc(event.track, ccindex, ccvalue);
+            if (command == ValueNone)
+                continue;
+            count += MaxCommandMessages;
+            if ((command == Message::TypeCommandRamp) ||
+                (command == Message::TypeCommandPitchWheel) ||
+                (command == Message::TypeCommandPitchSlide))
+                ramp_count++;
+        }
+    }
+    count += std::min(ramp_count, (int)Ramps::MaxRamps) * ramp_steps;
+    if (count > (int)queue.get_write_size())
+        return count;
+    
+    // send status package
+    queue.status_msg(mix_step);
+    
+    std::vector<ChannelRow> channel_rows;
+    index = 0;
+    for (iter = events.begin(); iter != events.end(); ++iter, ++index) {
+        Song::Event &event = (*iter)->second;
+        Pattern &pattern = *event.pattern;
+        Pattern::Row &row = rows[index];
+        int channel_count = pattern.get_channel_count();
+        channel_rows.resize(channel_count);
+        const Track &track = model->tracks[event.track];
+        int groove = 0;
+        if (!track.groove.empty())
+            groove = track.groove[queue.position % track.groove.size()];
+        groove = std::min(std::max(groove, 0), 0xff);
+        
+        // first run: process all commands and cc events
+        for (int channel = 0; channel < channel_count; ++channel) {
+            ChannelRow &values = channel_rows[channel];
+            values.bus = event.track;
+            values.channel = channel;
+            values.note = row.get_value(channel, ParamNote);
+            values.volume = row.get_value(channel, ParamVolume);
+            values.command = row.get_value(channel, ParamCommand);
+            values.value = row.get_value(channel, ParamValue);
+            values.ccindex = row.get_value(channel, ParamCCIndex);
+            values.ccvalue = row.get_value(channel, ParamCCValue);
+            values.delay = groove;
+            if (values.command != ValueNone)
+                command_table[values.command & 0x7f](*this, queue, values);
+            if ((values.ccindex != ValueNone) && (values.ccvalue != ValueNone))
+                ramps.set_value(event.track, values.ccindex, values.ccvalue);
+            queue.on_cc(event.track, values.ccindex, values.ccvalue);
         }
         
         // second run: process volume and notes
-        for (int channel = 0; channel < pattern.get_channel_count(); ++channel) {
-            queue.on_note(event.track, channel, 
-                row.get_value(channel, ParamNote),
-            row.get_value(channel, ParamVolume));
+        for (int channel = 0; channel < channel_count; ++channel) {
+            ChannelRow &values = channel_rows[channel];
+            if (!values.delay) {
+                queue.on_note(event.track, channel, values.note, values.volume);
+                continue;
+            }
+            Message msg;
+            if (queue.init_note(event.track, channel, values.note, values.volume, msg))
+                defer_message(values.delay, msg);
         }
     }
-    
+    return 0;
+}
+
+void Player::mix_ramp(MessageQueue &queue, int bus, int controller,
+                      int value, int frames) {
+    if ((controller == ValueNone) || (value == ValueNone))
+        return;
+    if (ramps.start(bus, controller, value, frames))
+        return;
+    ramps.set_value(bus, controller, value);
+    if (controller == Ramps::PitchWheel)
+        queue.on_pitch_wheel(bus, value);
+    else
+        queue.on_cc(bus, controller, value);
+}
+
+void Player::mix_steps(MessageQueue &queue, long long framesize) {
+    // ticks are placed relative to the beat the frame is in,
+    // so they stay aligned after seeks, loops and tempo changes.
+    int fpb = model->frames_per_beat;
+    int frame = queue.position % fpb;
+    int tick = 0;
+    int end_tick = 0;
+    if (clock_port != ValueNone) {
+        tick = (ClockTicksPerBeat*frame + fpb - 1) / fpb;
+        end_tick = (ClockTicksPerBeat*(frame + 1) + fpb - 1) / fpb;
+    }
+    if (framesize != subframe_frame_size)
+        update_subframe_offsets(framesize);
+    int steps = ramps.count?ramp_steps:0;
+    int step = 0;
+    size_t next = 0;
+    // merge ticks, ramp steps and deferred messages by time.
+    // all of them are within the frame.
+    while (true) {
+        long long tick_offset = framesize;
+        if (tick < end_tick)
+            tick_offset = ((long long)(tick*fpb - ClockTicksPerBeat*frame) * framesize) 
+                / ClockTicksPerBeat;
+        long long step_offset = framesize;
+        if (step < steps)
+            step_offset = framesize * step / steps;
+        long long msg_offset = framesize;
+        if (next < frame_messages.size())
+            msg_offset = subframe_offsets[frame_messages[next].subframe];
+        if ((msg_offset <= tick_offset) && (msg_offset <= step_offset)) {
+            if (msg_offset == framesize)
+                break;
+            Message msg = frame_messages[next++].msg;
+            msg.set_timestamp(queue.write_samples + msg_offset);
+            queue.push(msg);
+        } else if (tick_offset <= step_offset) {
+            mix_clock(queue, tick_offset);
+            tick++;
+        } else {
+            ramps.compute((float)step / (float)steps);
+            // values that did not change are not sent again
+            for (int i = 0; i < ramps.count; ++i) {
+                if (!ramps.changed(i))
+                    continue;
+                if (ramps.controller[i] == Ramps::PitchWheel)
+                    queue.on_pitch_wheel(ramps.bus[i], ramps.output[i], step_offset);
+                else
+                    queue.on_cc(ramps.bus[i], ramps.controller[i], ramps.output[i], step_offset);
+            }
+            step++;
+        }
+    }
+    frame_messages.clear();
+    ramps.next_frame();
+}
+
+void Player::mix_clock(MessageQueue &queue, long long offset) {
+    Message msg;
+    msg.set_timestamp(queue.write_samples + offset);
+    msg.frame = queue.position;
+    msg.port = clock_port;
+    msg.type = Message::TypeMIDI;
+    msg.status = MIDI::StatusTimingClock;
+    queue.push(msg);
+}
+
+void Player::update_subframe_offsets(long long framesize) {
+    for (int i = 0; i < 0x100; ++i) {
+        subframe_offsets[i] = (framesize * i) >> 8;
+    }
+    subframe_frame_size = framesize;
+}
+
+void Player::defer_message(int subframe, const Message &msg) {
+    FrameMessage message;
+    message.subframe = std::min(std::max(subframe, 0), 0xff);
+    message.msg = msg;
+    // after messages at the same time, so they keep their order
+    FrameMessageArray::iterator iter = frame_messages.end();
+    while ((iter != frame_messages.begin()) && 
+        ((iter - 1)->subframe > message.subframe)) {
+        --iter;
+    }
+    frame_messages.insert(iter, message);
+}
+
+void Player::command_arpeggio(MessageQueue &queue, ChannelRow &row) {
+    if ((row.value == ValueNone) || !is_key(row.note))
+        return;
+    // a third of the frame each for the note and the two
+    // intervals in the upper and lower nibble
+    int intervals[2] = { row.value >> 4, row.value & 0xf };
+    for (int i = 0; i < 2; ++i) {
+        Message msg;
+        int note = std::min(row.note + intervals[i], 119);
+        if (queue.init_note(row.bus, row.channel, note, row.volume, msg))
+            defer_message(row.delay + (i + 1) * 0x100 / 3, msg);
+    }
+}
+
+void Player::command_note_cut(MessageQueue &queue, ChannelRow &row) {
+    if (row.value == ValueNone)
+        return;
+    Message msg;
+    if (queue.init_note(row.bus, row.channel, NoteOff, ValueNone, msg))
+        defer_message(row.delay + row.value, msg);
+}
+
+void Player::command_note_delay(MessageQueue &queue, ChannelRow &row) {
+    if (row.value != ValueNone)
+        row.delay = std::min(row.delay + row.value, 0xff);
+}
+
+void Player::command_probability(MessageQueue &queue, ChannelRow &row) {
+    if ((row.value == ValueNone) || !is_key(row.note))
+        return;
+    if ((int)(next_random(random_state) % 0xff) < row.value)
+        return;
+    // neither the note nor its volume are sent
+    row.note = ValueNone;
+    row.volume = ValueNone;
+}
+
+void Player::command_retrigger(MessageQueue &queue, ChannelRow &row) {
+    if ((row.value == ValueNone) || !is_key(row.note))
+        return;
+    int interval = std::max(row.value, 0x100 / MaxCommandMessages);
+    for (int subframe = row.delay + interval; subframe < 0x100; subframe += interval) {
+        Message msg;
+        if (queue.init_note(row.bus, row.channel, row.note, row.volume, msg))
+            defer_message(subframe, msg);
+    }
+}
+
+void Player::command_ramp(MessageQueue &queue, ChannelRow &row) {
+    // the controller of the row is where the ramp goes
+    mix_ramp(queue, row.bus, row.ccindex, row.ccvalue, row.value);
+    row.ccindex = ValueNone;
+}
+
+void Player::command_pitch_slide(MessageQueue &queue, ChannelRow &row) {
+    if (row.value == ValueNone)
+        return;
+    int current = ramps.get_value(row.bus, Ramps::PitchWheel);
+    if (current == ValueNone) {
+        // assume the wheel is centered
+        current = 0x2000;
+        ramps.set_value(row.bus, Ramps::PitchWheel, current);
+    }
+    mix_ramp(queue, row.bus, Ramps::PitchWheel, slide_value(current, row.value), 1);
+}
+
+void Player::command_tempo(MessageQueue &queue, ChannelRow &row) {
+    if (row.value != ValueNone)
+        model->beats_per_minute = std::max(1,row.value);
+}
+
+void Player::command_channel_volume(MessageQueue &queue, ChannelRow &row) {
+    queue.on_command(row.bus, row.channel, Message::TypeCommandChannelVolume,
+        row.value, row.ccindex, row.ccvalue);
+}
+
+void Player::command_pitch_wheel(MessageQueue &queue, ChannelRow &row) {
+    if (row.ccvalue != ValueNone)
+        mix_ramp(queue, row.bus, Ramps::PitchWheel, wheel_value(row.ccvalue), row.value);
+    // the value of the row is where the wheel goes
+    row.ccindex = ValueNone;
 }
 
 void Player::handle_message(Message msg) {
@@ -319,36 +1629,66 @@ void Player::handle_message(Message msg) {
         return;
     }
     
+    if ((msg.type == Message::TypeMIDI) && (msg.status >= MIDI::StatusSysEx)) {
+        // system messages are passed on as they are
+        on_message(msg);
+        return;
+    }
+    
+    if (msg.type == Message::TypeNotesOff) {
+        if (msg.bus == ValueNone) {
+            // playback stopped or jumped, what the old queue
+            // passed on ahead is void
+            discard_messages();
+            silence_all();
+        } else {
+            // loop jumps stop the notes of each bus
+            // exactly where the loop ends
+            silence_bus(msg.bus, msg.timestamp);
+        }
+        return;
+    }
+    
     Bus &bus = buses[msg.bus];
     Channel &values = bus.channels[msg.bus_channel];
+    bool audible = (audible_buses & (1u << msg.bus)) != 0;
     
     if (msg.type == Message::TypeMIDI) {
         if (msg.command == MIDI::CommandControlChange) {
             switch(msg.data1) {
                 case MIDI::ControllerAllNotesOff:
                 {
-                    for (NoteArray::iterator iter = bus.notes.begin();
-                         iter != bus.notes.end(); ++iter) {
-                        *iter = -1;
+                    int key;
+                    while ((key = bus.keys.first()) != -1) {
+                        bus.keys.reset(key);
+                        bus.notes[key] = -1;
                     }
-                    on_message(msg);
+                    send_message(msg);
                 } break;
                 default:
                 {
-                    on_message(msg);
+                    // muted tracks keep their automation to themselves
+                    if (audible)
+                        send_message(msg);
                 } break;
             }
             return;
+        } else if (msg.command == MIDI::CommandPitchWheel) {
+            if (audible)
+                send_message(msg);
+            return;
         } else if (msg.command == MIDI::CommandAftertouch) {
+            if (!audible)
+                return;
             if (values.note != ValueNone) {
                 // insert note and pass on
                 msg.data1 = values.note;
-                on_message(msg);
+                send_message(msg);
             } else {
                 msg.command = MIDI::CommandChannelPressure;
                 msg.data1 = msg.data2;
                 msg.data2 = 0;
-                on_message(msg);
+                send_message(msg);
             }
             return;
         } else if (msg.command == MIDI::CommandNoteOff) {
@@ -359,9 +1699,10 @@ void Player::handle_message(Message msg) {
                 // on our channel, if yes, kill it.
                 if (bus.notes[note] == msg.bus_channel) {
                     bus.notes[note] = -1;
+                    bus.keys.reset(note);
                     msg.data1 = note;
                     msg.data2 = 0;
-                    on_message(msg);
+                    send_message(msg);
                 }
             }
             return;
@@ -371,21 +1712,114 @@ void Player::handle_message(Message msg) {
                 values.note = ValueNone;
                 // no matter where the note is played, kill it.
                 bus.notes[note] = -1;
+                bus.keys.reset(note);
                 Message off_msg(msg);
                 off_msg.command = MIDI::CommandNoteOff;
                 off_msg.data1 = note;
                 off_msg.data2 = 0;
-                on_message(off_msg);
+                send_message(off_msg);
             }
+            if (!audible)
+                return;
             values.note = msg.data1;
             int volume = std::min((int)((float)(msg.data2) * values.volume), 0x7f);
             msg.data2 = volume;
             bus.notes[values.note] = msg.bus_channel;
-            on_message(msg);
+            bus.keys.set(values.note);
+            bus.port = msg.port;
+            bus.midi_channel = msg.channel;
+            send_message(msg);
             return;
         }
     } else if (msg.type == Message::TypeCommandChannelVolume) {
         values.volume = std::min((float)(msg.status) / 0x7f, 1.0f);
+    } else if (msg.type == Message::TypeChannelReset) {
+        for (ChannelArray::iterator iter = bus.channels.begin();
+             iter != bus.channels.end(); ++iter) {
+            iter->volume = 1.0f;
+        }
+    }
+}
+
+void Player::send_message(const Message &msg) {
+    if ((msg.port >= 0) && (msg.port < MaxPorts)) {
+        NoteSet &notes = port_notes[msg.port * MIDIChannelCount + msg.channel];
+        switch(msg.command) {
+            case MIDI::CommandNoteOn:
+            {
+                // velocity 0 is a note off
+                if (msg.data2)
+                    notes.set(msg.data1);
+                else
+                    notes.reset(msg.data1);
+            } break;
+            case MIDI::CommandNoteOff:
+            {
+                notes.reset(msg.data1);
+            } break;
+            case MIDI::CommandControlChange:
+            {
+                if (msg.data1 == MIDI::ControllerAllNotesOff)
+                    notes.clear();
+            } break;
+            default: break;
+        }
+    }
+    on_message(msg);
+}
+
+void Player::silence_bus(int index, int timestamp) {
+    Bus &bus = buses[index];
+    int key;
+    while ((key = bus.keys.first()) != -1) {
+        int channel = bus.notes[key];
+        bus.keys.reset(key);
+        bus.notes[key] = -1;
+        if (bus.channels[channel].note == key)
+            bus.channels[channel].note = ValueNone;
+        Message msg;
+        msg.type = Message::TypeMIDI;
+        msg.bus = index;
+        msg.port = bus.port;
+        msg.command = MIDI::CommandNoteOff;
+        msg.channel = bus.midi_channel;
+        msg.data1 = key;
+        msg.data2 = 0;
+        msg.timestamp = timestamp;
+        send_message(msg);
+    }
+}
+
+void Player::silence_all() {
+    // forget the notes of all buses, then stop what is playing
+    // on each port, which may be more than the buses know of
+    // (notes sent while the bus moved to another port)
+    for (size_t index = 0; index < buses.size(); ++index) {
+        Bus &bus = buses[index];
+        int key;
+        while ((key = bus.keys.first()) != -1) {
+            int channel = bus.notes[key];
+            bus.keys.reset(key);
+            bus.notes[key] = -1;
+            if (bus.channels[channel].note == key)
+                bus.channels[channel].note = ValueNone;
+        }
+    }
+    for (size_t index = 0; index < port_notes.size(); ++index) {
+        NoteSet &notes = port_notes[index];
+        int key;
+        while ((key = notes.first()) != -1) {
+            Message msg;
+            msg.type = Message::TypeMIDI;
+            msg.bus = ValueNone;
+            msg.port = (int)(index / MIDIChannelCount);
+            msg.command = MIDI::CommandNoteOff;
+            msg.channel = (int)(index % MIDIChannelCount);
+            msg.data1 = key;
+            msg.data2 = 0;
+            // clears the key
+            send_message(msg);
+        }
     }
 }
 
@@ -396,33 +1830,82 @@ void Player::process_messages(int _size) {
     Message next_msg;
     Message msg;
     
+    // mute and solo take effect right away
+    unsigned int audible = ~muted_buses;
+    unsigned int solo = solo_buses;
+    if (solo)
+        audible &= solo;
+    if (audible != audible_buses) {
+        unsigned int silenced = audible_buses & ~audible;
+        audible_buses = audible;
+        for (int bus = 0; bus < MaxTracks; ++bus) {
+            if (silenced & (1u << bus))
+                silence_bus(bus);
+        }
+    }
+    
     while (!rt_messages.empty()) {
         msg = rt_messages.pop();
         msg.timestamp = 0;
         handle_message(msg);
     }
     
-    MessageQueue &queue = get_front();
+    int index = front_index;
+    MessageQueue &queue = messages[index];
     
     if (!playing) {
-        read_position = queue.position;
+        // the queue holds the premix for the cued position
         return;
     }
     
+    if (index != read_index) {
+        if (queue.splice) {
+            // the queue starts with the frame the last one was at,
+            // in the same timeline. skip what was sent already.
+            MessageQueue &last = messages[read_index];
+            queue.read_samples = last.read_samples;
+            long long sent = last.read_samples + last.lookahead;
+            while (!queue.empty() && (queue.get_timestamp(queue.peek()) < sent)) {
+                msg = queue.pop();
+                read_position = msg.frame;
+                if (msg.type == Message::TypeEmpty) {
+                    read_frame_samples = queue.get_timestamp(msg);
+                    read_step = msg.data;
+                }
+            }
+            queue.splice = false;
+        }
+        read_index = index;
+    }
+    
+    // messages are read ahead and sent earlier by the
+    // latency of their track
+    long long lookahead = queue.lookahead;
+    
     while (size) {
         long long delta = size;
         
         if (!queue.empty()) {
             next_msg = queue.peek();
-            delta = std::min(next_msg.timestamp - queue.read_samples, size);
-            if (delta < 0) {
-                // drop
-                queue.pop();
-                delta = 0;
-            } if (delta < size) {
+            long long timestamp = queue.get_timestamp(next_msg);
+            long long due = timestamp - lookahead - queue.read_samples;
+            delta = std::min(due, size);
+            if ((delta < size) && !can_send(next_msg)) {
+                // the outputs are full, wait for them to drain
+                delta = size;
+            } else if (delta < size) {
+                // messages that are due already, such as the chased
+                // state at the start of a premix that is read ahead,
+                // are sent right away instead of being dropped
+                delta = std::max(delta, (long long)0);
                 msg = queue.pop();
                 read_position = msg.frame;
-                msg.timestamp = offset;
+                if (msg.type == Message::TypeEmpty) {
+                    read_frame_samples = timestamp;
+                    read_step = msg.data;
+                }
+                // the message is due that many samples into this step
+                msg.set_timestamp(offset + due + lookahead - get_advance(msg));
                 handle_message(msg);
             }
         }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <vector>
+#include <map>
+#include <deque>
 #include "midi.hpp"
 #include "ring_buffer.hpp"
 
@@ -8,26 +10,48 @@ namespace Jacker {
 
 //=============================================================================
 
+// 16 bytes, so four fit into a cache line
 struct Message : MIDI::Message {
     enum Type {
         // empty, for updating position
         TypeEmpty = 0,
         // midi package
         TypeMIDI = 1,
+        // restores the default channel volumes of a bus
+        TypeChannelReset = 2,
+        // stops the notes playing on a bus, or on all buses
+        // if bus is ValueNone
+        TypeNotesOff = 3,
 	
 	// command
 	TypeCommandChannelVolume = 'V',
 	TypeCommandTempo = 'T',
+	TypeCommandRamp = 'R',
+	TypeCommandPitchWheel = 'W',
+	TypeCommandArpeggio = 'A',
+	TypeCommandNoteCut = 'C',
+	TypeCommandNoteDelay = 'D',
+	TypeCommandProbability = 'P',
+	TypeCommandRetrigger = 'Q',
+	TypeCommandPitchSlide = 'S',
     };
     
-    Type type;
-    long long timestamp;
+    // 24.8 fixed point samples. in a queue, the time since the
+    // queue started, wrapping around (see MessageQueue::get_timestamp).
+    // passed to on_message(), the offset into the period.
+    int timestamp;
+    // position in frames
     int frame;
-    int bus;
-    int bus_channel;
-    int port;
+    // see Type
+    unsigned char type;
+    // ValueNone for system messages and all buses
+    signed char bus;
+    unsigned char bus_channel;
+    signed char port;
     
     Message();
+    // sets timestamp from 32.32 samples
+    void set_timestamp(long long samples);
 };
 
 class MessageQueue : public RingBuffer<Message> {
@@ -36,27 +60,102 @@ public:
     volatile long long write_samples; // 0-32: subsample, 32-64: sample
     volatile int position; // in frames
     volatile long long read_samples;
+    // how far messages are read ahead of time for latency
+    // compensation, in 32.32 samples
+    long long lookahead;
+    // the queue continues the timeline of the queue played
+    // before it, see Player::process_messages()
+    volatile bool splice;
 
     void on_note(int bus, int channel, int value, int velocity);
-    void on_cc(int bus, int ccindex, int ccvalue);
+    // builds the message on_note() sends, returns false if
+    // there is nothing to send
+    bool init_note(int bus, int channel, int value, int velocity, Message &msg);
+    // offset is the time after write_samples in 32.32 samples
+    void on_cc(int bus, int ccindex, int ccvalue, long long offset=0);
+    void on_pitch_wheel(int bus, int value, long long offset=0);
     void on_command(int bus, int channel, Message::Type command, int value, int value2, int value3);
-    void all_notes_off(int bus);
+    void stop_notes(int bus);
+    void reset_channels(int bus);
+    // system messages, such as clock and song position
+    void on_system(int port, int status, int data1=0, int data2=0);
+    void on_song_position(int port, int position);
 
-    void status_msg();
+    // step is the playlist step of the frame
+    void status_msg(int step);
 
-    void init_message(int  bus, Message &msg);
+    void init_message(int  bus, Message &msg, long long offset=0);
+    // returns the timestamp of a queued message in 32.32 samples.
+    // messages are never more than a few seconds away from
+    // read_samples, which tells where the 24.8 timestamp wrapped.
+    long long get_timestamp(const Message &msg) const;
 
     void set_model(class Model &model);
 protected:
     class Model *model;
 };
 
+// follows an external midi clock. tick() is realtime safe and
+// estimates the tick length with a delay-locked loop, so jitter
+// on incoming ticks is filtered out.
+class ClockFollower {
+public:
+    enum {
+        TicksPerBeat = 24,
+        // ticks before the estimate is trusted
+        LockTicks = 24,
+    };
+    
+    ClockFollower();
+    void reset();
+    void set_sample_rate(int sample_rate);
+    
+    // tick received at an absolute time in samples
+    void tick(long long time);
+    // start, continue, stop and song position (in sixteenth notes)
+    void start();
+    void resume();
+    void stop();
+    void set_song_position(int position);
+    
+    bool is_running() const;
+    bool is_locked() const;
+    // estimated tick length in samples
+    double get_tick_size() const;
+    double get_beats_per_minute() const;
+    // estimated frame length in 32.32 samples
+    long long get_frame_size(int frames_per_beat) const;
+    // position of the last tick in ticks and frames
+    int get_position() const;
+    int get_frame(int frames_per_beat) const;
+    
+protected:
+    int sample_rate;
+    volatile bool running;
+    // ticks since start, for locking
+    volatile int tick_count;
+    // position of the last tick, in ticks
+    volatile int position;
+    // time of the last tick and predicted time of the next tick
+    double t0, t1;
+    // filtered tick length
+    volatile double tick_size;
+};
+
+//=============================================================================
+
+// calls the handler of a channel command, see Player::mix_frame()
+template<int C> struct CommandDispatch;
+
 class Player {
+    template<int C> friend struct CommandDispatch;
 public:
     enum {
         // how many message queues are used
         // for flipping?
         QueueCount = 4,
+        // midi clock resolution
+        ClockTicksPerBeat = 24,
     };
     
     struct Channel {
@@ -66,14 +165,161 @@ public:
         Channel();
     };
     
+    // incoming message, captured for recording
+    struct RecordEvent {
+        // position in frames
+        int frame;
+        // fraction of frame, 0-255
+        int subframe;
+        MIDI::Message msg;
+    };
+    
+    // the state a position inherits from the frames before it,
+    // sent again after seeks so controllers and volumes are
+    // what they would be when playing up to there.
+    struct ChaseState {
+        enum {
+            KeyVolume = 0,
+            KeyCC = 1,
+            // index is 0, value is 14-bit
+            KeyPitchWheel = 2,
+        };
+        // tempo in bpm, ValueNone if not set yet
+        int tempo;
+        // last channel volume and controller values, see make_key()
+        std::map<int,int> values;
+        
+        ChaseState();
+        void clear();
+        void set(int kind, int bus, int index, int value);
+        
+        static int make_key(int kind, int bus, int index);
+        static void split_key(int key, int &kind, int &bus, int &index);
+    };
+    
+    // glides controllers and the pitch wheel between rows. all
+    // storage is fixed, and values are computed over flat arrays
+    // so the loop vectorises.
+    struct Ramps {
+        enum {
+            // controllers 0-127, then the pitch wheel
+            PitchWheel = 128,
+            ControllerCount = 129,
+            MaxRamps = 256,
+        };
+        
+        int count;
+        // per ramp
+        int bus[MaxRamps];
+        int controller[MaxRamps];
+        float from[MaxRamps];
+        float delta[MaxRamps];
+        // 1 / length in frames
+        float rate[MaxRamps];
+        // frames since the start
+        float elapsed[MaxRamps];
+        // frames until the end
+        int remaining[MaxRamps];
+        // as computed by compute()
+        int output[MaxRamps];
+        // last value sent per bus and controller,
+        // ValueNone if not known
+        std::vector<short> values;
+        
+        // a running ramp, see save()
+        struct State {
+            int bus;
+            int controller;
+            float from;
+            float delta;
+            float rate;
+            float elapsed;
+            int remaining;
+        };
+        
+        Ramps();
+        // stops all ramps and takes the values from state
+        void reset(const ChaseState &state);
+        // appends the running ramps to states
+        void save(std::vector<State> &states) const;
+        // takes the values from state, then continues the
+        // saved ramps from where they were
+        void restore(const ChaseState &state, const std::vector<State> &states);
+        int get_value(int bus, int controller) const;
+        // sets a value right away, stopping a ramp on it
+        void set_value(int bus, int controller, int value);
+        // glides from the last value to value over frames. returns
+        // false if the value has to be set right away instead.
+        bool start(int bus, int controller, int value, int frames);
+        // computes the output at position (0-1) into the frame
+        void compute(float position);
+        // returns true if the output of a ramp is a new value,
+        // which then counts as sent
+        bool changed(int index);
+        // drops ramps that ended and moves on to the next frame
+        void next_frame();
+    };
+    
+    // a channel of the row being mixed, as commands see it
+    struct ChannelRow {
+        int bus;
+        int channel;
+        int note;
+        int volume;
+        int command;
+        int value;
+        int ccindex;
+        int ccvalue;
+        // when the note goes out, in 1/256 frame. starts
+        // with the groove of the track.
+        int delay;
+    };
+    
+    // a message going out later in the frame being mixed
+    struct FrameMessage {
+        // in 1/256 frame
+        int subframe;
+        Message msg;
+    };
+    
+    // a step of the compiled playlist, plays [begin, end)
+    struct Jump {
+        int begin;
+        int end;
+        
+        bool operator ==(const Jump &other) const;
+    };
+    
+    typedef std::vector<FrameMessage> FrameMessageArray;
+    typedef std::vector<Jump> JumpArray;
+    typedef std::vector<ChaseState> ChaseStateArray;
     typedef std::vector<Channel> ChannelArray;
     typedef std::vector<char> NoteArray;
     
+    // one bit per key
+    struct NoteSet {
+        unsigned int bits[4];
+        
+        NoteSet();
+        void set(int key);
+        void reset(int key);
+        void clear();
+        // lowest key in the set, or -1 if it is empty
+        int first() const;
+    };
+    
+    typedef std::vector<NoteSet> NoteSetArray;
+    
     struct Bus {
         ChannelArray channels;
         // stores which key is pressed on
         // which channel. (notes[key] = channel)
         NoteArray notes;
+        // keys with a channel in notes
+        NoteSet keys;
+        // where the last note went, for stopping notes
+        int port;
+        int midi_channel;
         
         Bus();
     };
@@ -83,27 +329,155 @@ public:
     void mix();
     void process_messages(int size);
     virtual void on_message(const Message &msg) {}
+    // messages are passed on up to the largest latency ahead.
+    // returns false while msg can not be taken without dropping
+    // it, it is then passed on later.
+    virtual bool can_send(const Message &msg) { return true; }
+    // drops what was passed to on_message() and is not due yet,
+    // so notes stopped on stops and seeks don't start after.
+    virtual void discard_messages() {}
     
     void set_model(class Model &model);
     void set_sample_rate(int sample_rate);
+    // overrides the frame length derived from the tempo with
+    // an external one in 32.32 samples, 0 to disable.
+    void set_frame_size(long long frame_size);
     
     void stop();
     void play();
-    void seek(int position);
+    // delay is the time until the frame at position begins in
+    // 32.32 samples, for starting between two frames.
+    void seek(int position, long long delay=0);
+    // premixes again from the frame being read, without
+    // repeating or dropping anything that was sent
     void flush();
     int get_position() const;
+    
+    // while stopped, the front queue is premixed from the current
+    // position so playback can start from the realtime thread.
+    // returns true if that premix starts at position.
+    bool is_cued(int position, long long delay=0) const;
+    // starts playing the premix, returns false if there is none.
+    // called from the realtime thread.
+    bool start_cued();
         
     bool is_playing() const;
     
     void play_event(int track, const class PatternEvent &event);
     void stop_events(int track);
+    
+    // compiles the playlist of the model, and applies it from
+    // the frame being read if it changed.
+    void update_playlist();
+    
+    // takes mute and solo from the tracks of the model. they
+    // apply to messages as they are sent, so changes take effect
+    // within a period. notes of tracks that fall silent are stopped.
+    void update_mute();
+    
+    void set_recording(bool enable);
+    bool is_recording() const;
+    // called from the realtime thread before process_messages()
+    // with the sample offset of the message in the period.
+    void record_message(int offset, const MIDI::Message &msg);
+    // fetches the next captured message, returns false if
+    // there are none.
+    bool pop_record_event(RecordEvent &event);
+    
+    // sends midi clock on port, or nothing if port is ValueNone
+    void set_clock_port(int port);
+    int get_clock_port() const;
+    
+    // how many values ramps send per frame at most, applied
+    // from the next premix on
+    void set_ramp_steps(int steps);
+    int get_ramp_steps() const;
+    
+    // fill of the front queue in 0-1 and the time mixed ahead
+    // of playback in samples, for statistics.
+    float get_queue_fill();
+    int get_premix_ahead();
+    // most messages a premix queue held, and how many it can hold
+    int get_queue_high_water() const;
+    int get_queue_capacity() const;
+    
+    // sets the latency behind a port in samples, applied
+    // with update_latency().
+    void set_port_latency(int port, int samples);
+    // sends messages earlier by the latency of their port and
+    // track. returns true and flushes if anything changed.
+    bool update_latency();
+    
+    // extends the chase checkpoints by a few bars as far as
+    // patterns are loaded, called regularly from the thread
+    // that seeks and edits.
+    void update_checkpoints();
+    // drops the checkpoints past frame, after an edit there
+    void invalidate_checkpoints(int frame);
+    // state at the start of a frame
+    void get_chase_state(int position, ChaseState &state);
         
 protected:
-    void premix();
+    void restart(int position, long long delay, bool chase_tempo);
+    // start is when the first frame begins in 32.32 samples,
+    // in the timeline of the queue being read for splices.
+    void premix(bool restart_clock, long long start, bool splice);
+    // playlist step for a position. before the first step
+    // begins, that is the first step, entered once playback gets
+    // there. otherwise the first step playing position, or the
+    // number of steps if there is none.
+    int find_step(int position) const;
+    void mix_chase(MessageQueue &queue, const ChaseState &state);
+    int get_chase_size(const ChaseState &state) const;
+    // invalidates checkpoints from where the song or a loaded
+    // pattern changed since the last call
+    void check_checkpoints();
+    // applies the frames [begin, end) to state. unless load is
+    // set, returns false and leaves state as it is if a pattern
+    // in the range has not been decoded yet.
+    bool chase_frames(ChaseState &state, int begin, int end, bool load=true);
     void mix_events(MessageQueue &queue, int samples);
-    void mix_frame(MessageQueue &queue);
+    // returns 0 if the frame was mixed, or how many messages it
+    // needs if it does not fit yet besides reserve more.
+    int mix_frame(MessageQueue &queue, int reserve);
+    // makes room for count messages in premix queues from the
+    // next premix on
+    void grow_queues(int count);
+    // sends a clock tick offset 32.32 samples into the frame
+    void mix_clock(MessageQueue &queue, long long offset);
+    // clock ticks, ramp values and deferred messages of a frame,
+    // in time order
+    void mix_steps(MessageQueue &queue, long long framesize);
+    // sends msg subframe/256 into the frame being mixed
+    void defer_message(int subframe, const Message &msg);
+    // recomputes subframe_offsets for another frame size
+    void update_subframe_offsets(long long framesize);
+    
+    // channel commands, see commands.txt
+    void command_arpeggio(MessageQueue &queue, ChannelRow &row);
+    void command_note_cut(MessageQueue &queue, ChannelRow &row);
+    void command_note_delay(MessageQueue &queue, ChannelRow &row);
+    void command_probability(MessageQueue &queue, ChannelRow &row);
+    void command_retrigger(MessageQueue &queue, ChannelRow &row);
+    void command_ramp(MessageQueue &queue, ChannelRow &row);
+    void command_pitch_slide(MessageQueue &queue, ChannelRow &row);
+    void command_tempo(MessageQueue &queue, ChannelRow &row);
+    void command_channel_volume(MessageQueue &queue, ChannelRow &row);
+    void command_pitch_wheel(MessageQueue &queue, ChannelRow &row);
+    // starts a ramp or sets the value right away
+    void mix_ramp(MessageQueue &queue, int bus, int controller,
+                  int value, int frames);
     void handle_message(Message msg);
+    // passes a message on to on_message() and keeps track
+    // of the notes playing on each port and midi channel
+    void send_message(const Message &msg);
+    // sends note offs for all notes playing on a bus,
+    // timestamped like the message that stops them
+    void silence_bus(int bus, int timestamp=0);
+    // sends note offs for all notes playing on any port
+    void silence_all();
     long long get_frame_size();
+    long long get_advance(const Message &msg) const;
 
     MessageQueue &get_back();
     MessageQueue &get_front();
@@ -111,13 +485,96 @@ protected:
 
     int sample_rate;
     volatile int front_index; // index of messages front buffer
+    // index of the queue the realtime thread read last
+    volatile int read_index;
+    // where the front queue started, to premix it again if it
+    // has not been read yet
+    int start_position;
+    long long start_delay;
+    bool start_splice;
     std::vector<Bus> buses;
+    // notes playing per port and midi channel, as sent
+    // (port_notes[port * 16 + channel])
+    NoteSetArray port_notes;
     MessageQueue messages[QueueCount];
     MessageQueue rt_messages;
+    // size of premix queues, grows with the density of the song
+    int queue_capacity;
+    // queues are smaller than queue_capacity
+    volatile bool capacity_pending;
+    int queue_high_water;
+    RingBuffer<RecordEvent> record_events;
     class Model *model;
     
     volatile int read_position; // last read position, in frames
+    // playlist step at read_position
+    volatile int read_step;
+    // timestamp of the frame at read_position
+    volatile long long read_frame_samples;
     volatile bool playing;
+    volatile bool recording;
+    volatile int clock_port;
+    volatile long long external_frame_size;
+    // one bit per bus, set by update_mute()
+    volatile unsigned int muted_buses;
+    volatile unsigned int solo_buses;
+    // buses that are heard, as last applied by the realtime thread
+    unsigned int audible_buses;
+    // latency compensation, in samples and 32.32 samples
+    std::vector<int> port_latency;
+    std::vector<long long> port_advance;
+    std::vector<long long> bus_advance;
+    long long max_advance;
+    // start or continue has been sent
+    volatile bool clock_started;
+    // position of the premix while stopped
+    volatile bool cue_ready;
+    volatile int cue_position;
+    volatile long long cue_delay;
+    // state at the start of every bar up to scan_frame
+    ChaseStateArray checkpoints;
+    int checkpoint_interval;
+    int scan_frame;
+    ChaseState scan_state;
+    // what the checkpoints were chased from, to find edits
+    struct ChaseSource {
+        int frame;
+        int track;
+        int length;
+        const class Pattern *pattern;
+    };
+    std::vector<ChaseSource> checkpoint_events;
+    std::map<const class Pattern *, long long> checkpoint_revisions;
+    // state sent with the last premix
+    ChaseState chase_state;
+    // state sent at the loop jump
+    ChaseState loop_state;
+    // the playlist and the step at the write position of the
+    // queue being mixed
+    JumpArray jumps;
+    int mix_step;
+    // ramps running at the write position of the queue being mixed
+    Ramps ramps;
+    int ramp_steps;
+    // ramps running at the start of the frames mixed ahead of
+    // the reader, so splices continue them. frames without
+    // running ramps are left out.
+    struct RampFrame {
+        // start of the frame in 32.32 samples, in the
+        // timeline of the queue
+        long long samples;
+        std::vector<Ramps::State> ramps;
+    };
+    std::deque<RampFrame> ramp_frames;
+    // sorted by time
+    FrameMessageArray frame_messages;
+    // time of each 1/256 frame in 32.32 samples, for the frame
+    // size they were computed for, so deferred messages only
+    // look up their offset
+    long long subframe_offsets[0x100];
+    long long subframe_frame_size;
+    // for the probability command
+    unsigned int random_state;
 };
 
 //=============================================================================
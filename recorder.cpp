@@ -0,0 +1,160 @@
+#include "recorder.hpp"
+
+#include <algorithm>
+
+namespace Jacker {
+
+//=============================================================================
+
+static bool event_frame_less(const Pattern::Event &a, const Pattern::Event &b) {
+    return a.frame < b.frame;
+}
+
+//=============================================================================
+
+Recorder::Recorder() {
+    mode = ModeOverdub;
+    note_channels.resize(128);
+    note_frames.resize(128);
+    channel_notes.resize(MaxChannels);
+    reset();
+}
+
+void Recorder::set_mode(Mode mode) {
+    this->mode = mode;
+}
+
+Recorder::Mode Recorder::get_mode() const {
+    return mode;
+}
+
+void Recorder::reset() {
+    std::fill(note_channels.begin(), note_channels.end(), (int)ValueNone);
+    std::fill(note_frames.begin(), note_frames.end(), (int)ValueNone);
+    std::fill(channel_notes.begin(), channel_notes.end(), (int)ValueNone);
+    channel_count = 1;
+    clear_frame = ValueNone;
+}
+
+void Recorder::discard(Player &player) {
+    Player::RecordEvent record_event;
+    while (player.pop_record_event(record_event)) {
+    }
+}
+
+int Recorder::find_free_channel(Pattern &pattern, int channel) {
+    for (int i = channel; i < pattern.get_channel_count(); ++i) {
+        if (channel_notes[i] == ValueNone)
+            return i;
+    }
+    return ValueNone;
+}
+
+void Recorder::add_message(Pattern &pattern, int frame, int channel, 
+                           const MIDI::Message &msg) {
+    switch(msg.command) {
+        case MIDI::CommandNoteOn:
+        {
+            int note = msg.data1;
+            if (msg.data2 && (note < NoteOff)) {
+                if (note_channels[note] != ValueNone)
+                    break; // already held
+                int note_channel = find_free_channel(pattern, channel);
+                if (note_channel == ValueNone)
+                    break; // out of channels
+                note_channels[note] = note_channel;
+                note_frames[note] = frame;
+                channel_notes[note_channel] = note;
+                channel_count = std::max(channel_count, 
+                    note_channel - channel + 1);
+                Pattern::Event event(frame, note_channel, ParamNote, note);
+                event.sanitize_value();
+                events.push_back(event);
+                events.push_back(Pattern::Event(frame, note_channel, 
+                    ParamVolume, msg.data2));
+                break;
+            }
+        } // velocity 0 is a note off
+        case MIDI::CommandNoteOff:
+        {
+            int note = msg.data1;
+            int note_channel = note_channels[note];
+            if (note_channel == ValueNone)
+                break;
+            note_channels[note] = ValueNone;
+            channel_notes[note_channel] = ValueNone;
+            // a note off on the same row would replace the note
+            if (note_frames[note] == frame)
+                break;
+            events.push_back(Pattern::Event(frame, note_channel, 
+                ParamNote, NoteOff));
+        } break;
+        case MIDI::CommandControlChange:
+        {
+            events.push_back(Pattern::Event(frame, channel, 
+                ParamCCIndex, msg.data1));
+            events.push_back(Pattern::Event(frame, channel, 
+                ParamCCValue, msg.data2));
+        } break;
+        default: break;
+    }
+}
+
+int Recorder::process(Player &player, Song::Event &event, int channel) {
+    Pattern &pattern = *event.pattern;
+    int length = pattern.get_length();
+    if ((channel < 0) || (channel >= pattern.get_channel_count())) {
+        discard(player);
+        return 0;
+    }
+    
+    events.clear();
+    int end_frame = player.get_position() - event.frame;
+    if ((end_frame > 0) && (end_frame < event.get_length()))
+        end_frame = event.get_pattern_frame(player.get_position());
+    Player::RecordEvent record_event;
+    while (player.pop_record_event(record_event)) {
+        int frame = record_event.frame - event.frame;
+        if ((frame < 0) || (frame >= event.get_length()))
+            continue;
+        // quantise to the nearest row, past the last row
+        // is the first one
+        if (record_event.subframe >= 128)
+            frame++;
+        // the pattern repeats in longer events
+        frame %= length;
+        add_message(pattern, frame, channel, record_event.msg);
+    }
+    
+    if (mode == ModeReplace) {
+        // rows quantised ahead of the play position are cleared now,
+        // so they don't get cleared again with the next batch.
+        for (EventArray::iterator iter = events.begin(); 
+             iter != events.end(); ++iter) {
+            if ((iter->frame >= clear_frame) && (iter->frame >= end_frame))
+                end_frame = iter->frame + 1;
+        }
+        end_frame = std::min(std::max(end_frame, 0), length);
+        int channel_end = channel + channel_count;
+        if (clear_frame == ValueNone) {
+            // just started
+            clear_frame = end_frame;
+        } else if (end_frame < clear_frame) {
+            // looped, finish the end of the pattern first
+            pattern.erase_events(clear_frame, length, channel, channel_end);
+            clear_frame = 0;
+        }
+        pattern.erase_events(clear_frame, end_frame, channel, channel_end);
+        clear_frame = end_frame;
+    }
+    
+    if (events.empty())
+        return 0;
+    std::stable_sort(events.begin(), events.end(), event_frame_less);
+    pattern.merge_events(&events[0], (int)events.size());
+    return (int)events.size();
+}
+
+//=============================================================================
+
+} // namespace Jacker
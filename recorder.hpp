@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include "model.hpp"
+#include "player.hpp"
+
+namespace Jacker {
+    
+//=============================================================================
+
+// writes messages captured by the player into a pattern
+class Recorder {
+public:
+    enum Mode {
+        // recorded events are added to the pattern
+        ModeOverdub = 0,
+        // rows passed while recording are cleared first
+        ModeReplace = 1,
+    };
+    
+    Recorder();
+    
+    void set_mode(Mode mode);
+    Mode get_mode() const;
+    
+    // forgets held notes, call when recording starts
+    void reset();
+    
+    // moves all captured messages into the pattern of event,
+    // starting at channel, and returns how many pattern events 
+    // have been written.
+    int process(Player &player, Song::Event &event, int channel);
+    // discards all captured messages
+    void discard(Player &player);
+    
+protected:
+    void add_message(Pattern &pattern, int frame, int channel, 
+                     const MIDI::Message &msg);
+    int find_free_channel(Pattern &pattern, int channel);
+    
+    typedef std::vector<Pattern::Event> EventArray;
+    typedef std::vector<int> IntArray;
+
+    Mode mode;
+    // channel each note is held on, or ValueNone
+    IntArray note_channels;
+    // frame each note started on
+    IntArray note_frames;
+    // note held on each channel, or ValueNone
+    IntArray channel_notes;
+    // number of channels used since reset
+    int channel_count;
+    // first row not cleared yet, for replace mode
+    int clear_frame;
+    // events of the current batch
+    EventArray events;
+};
+
+//=============================================================================
+
+} // namespace Jacker
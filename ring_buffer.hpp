@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <vector>
+#include <algorithm>
 
 template<typename T>
 class RingBuffer {
@@ -39,7 +40,7 @@ public:
 		written = 0;
 		read_count = 0;
         if (wipe)
-            memset(&buffer[0], 0, get_size() * sizeof(T));
+            std::fill(buffer.begin(), buffer.end(), T());
 	}
 
 	size_t get_size() {
@@ -119,7 +120,7 @@ public:
 
 	void write(const T *data, size_t count) {
 		if (get_write_size() < count) {
-			fprintf(stderr, "RingBuffer: write overflow (%i < %i)\n", get_write_size(), count);
+			fprintf(stderr, "RingBuffer: write overflow (%i < %i)\n", (int)get_write_size(), (int)count);
 			fflush(stderr);
 			return;
 		}
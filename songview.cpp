@@ -83,6 +83,7 @@ SongView::SongView(BaseObjectType* cobject,
     vadjustment = NULL;
     snap_mode = SnapBar;
     interact_mode = InteractNone;
+    resize_repeat = false;
     colors.resize(ColorCount);
     colors[ColorBlack].set("#000000");
     colors[ColorWhite].set("#FFFFFF");
@@ -214,6 +215,16 @@ void SongView::render_event(Song::iterator event) {
         // TODO: make this fast
         window->draw_layout(gc, x+3, y+5, pango_layout);
     }
+    // mark where the pattern repeats, unless it is being resized
+    int pw, ph;
+    get_event_size(event->second.pattern->get_length(), pw, ph);
+    bool resize_pattern = resizing() && selected && !resize_repeat &&
+        (event->second.length == ValueNone);
+    if ((pw > 2) && !resize_pattern) {
+        for (int px = pw; px < w; px += pw) {
+            window->draw_rectangle(gc, true, x+px, y+3, 1, h-6);
+        }
+    }
 }
 
 void SongView::render_track(int track) {
@@ -541,14 +552,21 @@ void SongView::join_selection() {
         Pattern &old_pattern = *song_event.pattern;
         
         int frame_offset = song_event.frame - frame_begin;
+        int length = song_event.get_length();
         
-        // merge pattern events
-        for (Pattern::iterator jter = old_pattern.begin();
-             jter != old_pattern.end(); ++jter) {
-            Pattern::Event pattern_event = jter->second;
-            pattern_event.channel += track_channels[song_event.track];
-            pattern_event.frame += frame_offset;
-            pattern.add_event(pattern_event);
+        old_pattern.load();
+        // merge pattern events, as often as the pattern repeats
+        for (int repeat = 0; repeat < length; 
+             repeat += std::max(old_pattern.get_length(), 1)) {
+            for (Pattern::iterator jter = old_pattern.begin();
+                 jter != old_pattern.end(); ++jter) {
+                Pattern::Event pattern_event = jter->second;
+                if ((repeat + pattern_event.frame) >= length)
+                    break;
+                pattern_event.channel += track_channels[song_event.track];
+                pattern_event.frame += frame_offset + repeat;
+                pattern.add_event(pattern_event);
+            }
         }
     }
     
@@ -607,6 +625,7 @@ bool SongView::on_motion_notify_event(GdkEventMotion *event) {
             Song::iterator evt;
             if (find_event(cur, evt) && can_resize_event(evt,drag.start_x)) {
                 interact_mode = InteractResize;
+                resize_repeat = ctrl_down;
             } else {
                 if (shift_down) {
                     invalidate_selection();
@@ -677,15 +696,19 @@ void SongView::apply_move() {
     do_move(ofs_frame, ofs_track);
 }
 
-void SongView::do_resize(int ofs_frame) {
+void SongView::do_resize(int ofs_frame, bool repeat) {
     // verify that we can move
     for (Song::IterList::iterator iter = selection.begin();
         iter != selection.end(); ++iter) {
         Song::Event &event = (*iter)->second;
-        int length = std::max(event.pattern->get_length() + ofs_frame, 
+        int length = std::max(event.get_length() + ofs_frame, 
             get_step_size());
-            
-        event.pattern->set_length(length);
+        
+        // events that repeat their pattern keep doing so
+        if (repeat || (event.length != ValueNone))
+            event.set_length(length);
+        else
+            event.pattern->set_length(length);
     }
     
     invalidate();
@@ -696,7 +719,7 @@ void SongView::apply_resize() {
     
     int ofs_frame,ofs_track;
     get_drag_offset(ofs_frame, ofs_track);
-    do_resize(ofs_frame);
+    do_resize(ofs_frame, resize_repeat);
 }
 
 bool SongView::on_button_release_event(GdkEventButton* event) {
@@ -915,14 +938,14 @@ bool SongView::on_key_press_event(GdkEventKey* event) {
             } break;
             case GDK_Left: {
                 if (alt_down)
-                    do_resize(-get_step_size());
+                    do_resize(-get_step_size(), ctrl_down);
                 else
                     do_move(-get_step_size(),0); 
                 return true;
             } break;
             case GDK_Right: {
                 if (alt_down)
-                    do_resize(get_step_size());
+                    do_resize(get_step_size(), ctrl_down);
                 else
                     do_move(get_step_size(),0); 
                 return true;
@@ -931,7 +954,7 @@ bool SongView::on_key_press_event(GdkEventKey* event) {
                 int f0,f1,t0,t1;
                 if (get_selection_range(f0,f1,t0,t1)) {
                     if (alt_down)
-                        do_resize((f1-f0));
+                        do_resize((f1-f0), ctrl_down);
                     else
                         do_move((f1-f0),0);
                 }
@@ -941,7 +964,7 @@ bool SongView::on_key_press_event(GdkEventKey* event) {
                 int f0,f1,t0,t1;
                 if (get_selection_range(f0,f1,t0,t1)) {
                     if (alt_down)
-                        do_resize(-((f1-f0)/2));
+                        do_resize(-((f1-f0)/2), ctrl_down);
                     else
                         do_move(-(f1-f0),0);
                 }
@@ -1041,7 +1064,7 @@ void SongView::get_event_rect(Song::iterator iter, int &x, int &y, int &w, int &
     Song::Event &event = iter->second;
     int frame = event.frame;
     int track = event.track;
-    int length = event.pattern->get_length();
+    int length = event.get_length();
     if (moving() && is_event_selected(iter)) {
         int ofs_frame,ofs_track;
         get_drag_offset(ofs_frame, ofs_track);
@@ -172,7 +172,9 @@ protected:
     void apply_move();
     void apply_resize();
     void do_move(int frame_ofs, int track_ofs);
-    void do_resize(int frame_ofs);
+    // resizes the patterns, or with repeat set, the events,
+    // which then repeat their pattern
+    void do_resize(int frame_ofs, bool repeat=false);
 
     void update_adjustments();
     void on_adjustment_value_changed();
@@ -191,6 +193,8 @@ protected:
 
     InteractMode interact_mode;
     SnapMode snap_mode;
+    // resize drags set the event length
+    bool resize_repeat;
 
     int play_position;
     Drag drag;
@@ -0,0 +1,131 @@
+// writes songs with journals, reads them back lazily and checks
+// that the replayed changes survive decoding the remaining
+// patterns. run with "scons test".
+
+#include "jsong.hpp"
+#include "model.hpp"
+
+#include <stdio.h>
+#include <cstdio>
+
+using namespace Jacker;
+
+//=============================================================================
+
+static const char *song_path = "test_jsong.jsong";
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (ok)
+        return;
+    printf("FAIL: %s\n", what);
+    failures++;
+}
+
+static void remove_song() {
+    std::remove(song_path);
+    std::remove(JSongJournal::get_path(song_path).c_str());
+}
+
+// two patterns with a note at frame 0, so the first one can be edited
+// while the second one stays pending
+static void write_song() {
+    Model model;
+    model.reset();
+    for (int i = 0; i < 2; ++i) {
+        Pattern &pattern = model.new_pattern();
+        pattern.add_event(0, 0, ParamNote, 40 + i);
+        model.song.add_event(i * 16, 0, pattern);
+    }
+    write_jsong(model, song_path);
+}
+
+static Pattern *get_pattern(Model &model, int index) {
+    PatternList::iterator iter = model.patterns.begin();
+    for (int i = 0; (i < index) && (iter != model.patterns.end()); ++i) {
+        ++iter;
+    }
+    if (iter == model.patterns.end())
+        return NULL;
+    return *iter;
+}
+
+//=============================================================================
+
+// a pattern replaced by the journal is not decoded from the file again
+static void test_replay_then_load() {
+    remove_song();
+    write_song();
+    {
+        Model model;
+        read_jsong(model, song_path, true);
+        JSongJournal journal;
+        journal.open(model, song_path);
+        Pattern *pattern = get_pattern(model, 0);
+        pattern->erase_events(0, 1, 0, 1);
+        pattern->add_event(4, 0, ParamNote, 50);
+        check(journal.write(model) == 1, "journaled pattern");
+    }
+    Model model;
+    read_jsong(model, song_path, true);
+    JSongJournal journal;
+    check(journal.open(model, song_path) == 1, "replayed pattern");
+    Pattern *pattern = get_pattern(model, 0);
+    check(pattern && (pattern->size() == 1), "events after replay");
+    model.load_patterns();
+    pattern = get_pattern(model, 0);
+    check(pattern && (pattern->size() == 1), "events after loading");
+    check(pattern && (pattern->begin()->second.frame == 4),
+        "event frame after loading");
+    check(get_pattern(model, 1)->size() == 1, "pending pattern");
+    check(journal.write(model) == 0, "nothing to journal after loading");
+    remove_song();
+}
+
+// a pattern allocated where a deleted one was gets
+// nothing of the deleted pattern's state
+static void test_delete_then_new() {
+    remove_song();
+    write_song();
+    {
+        Model model;
+        read_jsong(model, song_path, true);
+        JSongJournal journal;
+        journal.open(model, song_path);
+        // drop the second pattern while it is still pending
+        Song::iterator last = model.song.begin();
+        ++last;
+        model.song.erase(last);
+        model.delete_unused_patterns();
+        check(model.patterns.size() == 1, "deleted pattern");
+        Pattern &pattern = model.new_pattern();
+        pattern.add_event(8, 0, ParamNote, 60);
+        model.song.add_event(16, 0, pattern);
+        model.load_patterns();
+        check(pattern.size() == 1, "events of new pattern");
+        check(journal.write(model) == 2, "journaled new pattern and song");
+    }
+    Model model;
+    read_jsong(model, song_path, true);
+    JSongJournal journal;
+    journal.open(model, song_path);
+    model.load_patterns();
+    check(model.patterns.size() == 2, "patterns after replay");
+    Pattern *pattern = get_pattern(model, 1);
+    check(pattern && (pattern->size() == 1), "events after replay");
+    check(pattern && (pattern->begin()->second.frame == 8),
+        "event frame after replay");
+    remove_song();
+}
+
+int main(int argc, char **argv) {
+    test_replay_then_load();
+    test_delete_then_new();
+    if (failures) {
+        printf("%i checks failed.\n", failures);
+        return 1;
+    }
+    printf("All checks passed.\n");
+    return 0;
+}
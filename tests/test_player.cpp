@@ -0,0 +1,133 @@
+// drives the player through the mock backend and checks that
+// messages go out at the sample they are due, whatever the
+// period size. run with "scons test".
+
+#include "jack_mock.hpp"
+#include "jackplayer.hpp"
+#include "model.hpp"
+
+#include <stdio.h>
+#include <vector>
+
+using namespace Jacker;
+
+//=============================================================================
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, int period) {
+    if (ok)
+        return;
+    printf("FAIL: %s (period %i)\n", what, period);
+    failures++;
+}
+
+// a song with a note every third frame of a 64 frame pattern
+static void init_song(Model &model, int bpm, bool loop) {
+    model.reset();
+    model.frames_per_beat = 4;
+    model.beats_per_minute = bpm;
+    model.enable_loop = loop;
+    model.loop.set(0, 8);
+    Pattern &pattern = model.new_pattern();
+    pattern.set_length(64);
+    pattern.set_channel_count(1);
+    for (int frame = 0; frame < 64; frame += 3) {
+        pattern.add_event(frame, 0, ParamNote, 40 + frame % 20);
+    }
+    model.song.add_event(0, 0, pattern);
+}
+
+// plays for samples with the given period size and returns the
+// times of the note ons sent on a port
+static std::vector<long long> play_notes(Model &model, Jack::NFrames sample_rate,
+                                         int period, long long samples,
+                                         const char *port) {
+    Jack::MockBackend backend(sample_rate, period);
+    std::vector<long long> times;
+    JackPlayer player(&backend);
+    player.set_model(model);
+    if (!player.init())
+        return times;
+    player.activate();
+    player.update_ports();
+    player.play();
+    // mixes every 100 ms, as the mix timer does
+    long long mix_interval = sample_rate / 10;
+    long long next_mix = 0;
+    while (backend.get_frame_time() < samples) {
+        if (backend.get_frame_time() >= next_mix) {
+            player.mix();
+            next_mix += mix_interval;
+        }
+        backend.process();
+    }
+    const Jack::MockBackend::EventArray &events = backend.get_output(port);
+    for (size_t i = 0; i < events.size(); ++i) {
+        if ((events[i].data[0] & 0xf0) == 0x90)
+            times.push_back(events[i].time);
+    }
+    player.deactivate();
+    player.shutdown();
+    return times;
+}
+
+//=============================================================================
+
+// note ons land on the sample their frame begins, rounded down
+static void test_offsets(int period) {
+    Model model;
+    init_song(model, 120, false);
+    // 5512.5 samples per frame, so rounding shows up as well
+    Jack::NFrames sample_rate = 44100;
+    long long frame_size = ((long long)sample_rate * 60 << 32) / (120 * 4);
+    std::vector<long long> times = play_notes(model, sample_rate, period,
+        (long long)sample_rate * 4, "port-0");
+    check(times.size() == 11, "note count", period);
+    for (size_t i = 0; i < times.size(); ++i) {
+        long long expected = ((long long)i * 3 * frame_size) >> 32;
+        if (times[i] != expected) {
+            printf("note %i at %lld, expected %lld\n", (int)i, times[i], expected);
+            check(false, "note offset", period);
+            break;
+        }
+    }
+    std::vector<long long> omni = play_notes(model, sample_rate, period,
+        (long long)sample_rate * 4, "omni");
+    check(omni == times, "omni port timing", period);
+}
+
+// loop jumps keep the notes on the grid
+static void test_loop_offsets(int period) {
+    Model model;
+    init_song(model, 120, true);
+    Jack::NFrames sample_rate = 48000;
+    // 6000 samples per frame
+    int frame_size = 6000;
+    // stops before the fifth pass, even with the last period
+    std::vector<long long> times = play_notes(model, sample_rate, period,
+        31 * frame_size, "port-0");
+    // frames 0, 3 and 6 of each pass through [0, 8)
+    check(times.size() == 12, "looped note count", period);
+    for (size_t i = 0; i < times.size(); ++i) {
+        long long expected = ((long long)(i / 3) * 8 + (i % 3) * 3) * frame_size;
+        if (times[i] != expected) {
+            printf("note %i at %lld, expected %lld\n", (int)i, times[i], expected);
+            check(false, "looped note offset", period);
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int period = 16; period <= 4096; period *= 2) {
+        test_offsets(period);
+        test_loop_offsets(period);
+    }
+    if (failures) {
+        printf("%i checks failed.\n", failures);
+        return 1;
+    }
+    printf("All checks passed.\n");
+    return 0;
+}
@@ -1,11 +1,15 @@
 #include "trackview.hpp"
 
 #include <cassert>
+#include <cstdlib>
+#include <algorithm>
 
 namespace Jacker {
 
 enum {
     TrackHeight = 22,
+    // highest latency offset that can be set, in ms
+    MaxTrackLatency = 1000,
 };
 
 //=============================================================================
@@ -41,8 +45,15 @@ TrackBar::TrackBar(int index, TrackView &view) {
 
     for (int i = 0; i < MaxPorts; ++i) {
         char buffer[64];
+        Gtk::Menu &submenu = port_submenus[i / PortsPerMenu];
+        if (!(i % PortsPerMenu)) {
+            int last = std::min(i + PortsPerMenu, (int)MaxPorts) - 1;
+            sprintf(buffer, "port-%i - port-%i", i, last);
+            port_menu.items().push_back(
+                Gtk::Menu_Helpers::MenuElem(buffer, submenu));
+        }
         sprintf(buffer, "port-%i", i);
-        port_menu.items().push_back(
+        submenu.items().push_back(
             Gtk::Menu_Helpers::RadioMenuElem(port_radio_group, buffer, 
                 sigc::bind<int>(
                     sigc::mem_fun(*this, &TrackBar::on_port), i)                    
@@ -74,6 +85,12 @@ TrackBar::TrackBar(int index, TrackView &view) {
     view.group_mutes->add_widget(mute);
     pack_start(mute, false, true);
     
+    solo.set_label("S");
+    solo.signal_toggled().connect(
+        sigc::mem_fun(*this, &TrackBar::on_solo_toggled));
+    view.group_solos->add_widget(solo);
+    pack_start(solo, false, true);
+    
     update();
     
     view.pack_start(*this, false, false);
@@ -95,6 +112,15 @@ void TrackBar::on_mute_toggled() {
     view->_mute_toggled(index, active);
 }
 
+void TrackBar::on_solo_toggled() {
+    bool active = solo.get_active();
+    if (model->tracks[index].solo == active)
+        return;
+    model->tracks[index].solo = active;
+    update();
+    view->_solo_toggled(index, active);
+}
+
 void TrackBar::on_channel(int channel) {
     model->tracks[index].midi_channel = channel;
     update();
@@ -115,17 +141,57 @@ bool TrackBar::on_name_button_press_event(GdkEventButton *event) {
     } else if ((event->type == GDK_2BUTTON_PRESS) &&
         (event->button == 1)) {
         Track &track = model->tracks[index];
-        Gtk::Dialog dialog("Rename Track", true, false);
+        Gtk::Dialog dialog("Track Properties", true, false);
         Gtk::Entry text_entry;
         dialog.get_vbox()->pack_start(text_entry);
         text_entry.set_text(track.name);
         text_entry.show();
+        // sent that much earlier to make up for slow instruments
+        Gtk::HBox latency_box(false, 5);
+        Gtk::Label latency_label("Latency (ms)");
+        Gtk::SpinButton latency_spin;
+        latency_spin.set_range(0, MaxTrackLatency);
+        latency_spin.set_increments(1, 10);
+        latency_spin.set_value(track.latency);
+        latency_spin.set_activates_default(true);
+        latency_box.pack_start(latency_label, false, false);
+        latency_box.pack_start(latency_spin, true, true);
+        dialog.get_vbox()->pack_start(latency_box);
+        latency_box.show_all();
+        // note delays per frame in hex, e.g. "00 40" for swing
+        Gtk::HBox groove_box(false, 5);
+        Gtk::Label groove_label("Groove");
+        Gtk::Entry groove_entry;
+        std::string groove_text;
+        for (size_t i = 0; i < track.groove.size(); ++i) {
+            char buffer[8];
+            sprintf(buffer, i?" %02X":"%02X", track.groove[i]);
+            groove_text += buffer;
+        }
+        groove_entry.set_text(groove_text);
+        groove_entry.set_activates_default(true);
+        groove_box.pack_start(groove_label, false, false);
+        groove_box.pack_start(groove_entry, true, true);
+        dialog.get_vbox()->pack_start(groove_box);
+        groove_box.show_all();
         dialog.add_button(Gtk::Stock::OK, Gtk::RESPONSE_OK);
         dialog.set_default_response(Gtk::RESPONSE_OK);
         text_entry.set_activates_default(true);
         int response = dialog.run();
         if (response == Gtk::RESPONSE_OK) {
             track.name = text_entry.get_text();
+            track.latency = latency_spin.get_value_as_int();
+            track.groove.clear();
+            std::string text = groove_entry.get_text();
+            const char *pos = text.c_str();
+            while (*pos) {
+                char *end = NULL;
+                long delay = strtol(pos, &end, 16);
+                if (end == pos)
+                    break;
+                track.groove.push_back(std::min(std::max((int)delay, 0), 0xff));
+                pos = end;
+            }
             update();
         }
         return true;
@@ -151,7 +217,7 @@ bool TrackBar::on_port_button_press_event(GdkEventButton *event) {
         (event->button == 1)) {
         int port = model->tracks[index].midi_port;
         Gtk::CheckMenuItem &item = (Gtk::CheckMenuItem &)
-            port_menu.items()[port];
+            port_submenus[port / PortsPerMenu].items()[port % PortsPerMenu];
         item.set_active();
         port_menu.popup(event->button, event->time);
         return true;
@@ -178,6 +244,7 @@ void TrackBar::update() {
     port.set_text(buffer);
     
     mute.set_active(track.mute);
+    solo.set_active(track.solo);
 }
 
 //=============================================================================
@@ -190,6 +257,7 @@ TrackView::TrackView(BaseObjectType* cobject,
     group_channels = Gtk::SizeGroup::create(Gtk::SIZE_GROUP_HORIZONTAL);
     group_ports = Gtk::SizeGroup::create(Gtk::SIZE_GROUP_HORIZONTAL);
     group_mutes = Gtk::SizeGroup::create(Gtk::SIZE_GROUP_HORIZONTAL);
+    group_solos = Gtk::SizeGroup::create(Gtk::SIZE_GROUP_HORIZONTAL);
 }
 
 TrackView::~TrackView() {
@@ -208,6 +276,10 @@ TrackView::type_mute_toggled TrackView::signal_mute_toggled() {
     return _mute_toggled;
 }
 
+TrackView::type_solo_toggled TrackView::signal_solo_toggled() {
+    return _solo_toggled;
+}
+
 void TrackView::set_model(class Model &model) {
     this->model = &model;
 }
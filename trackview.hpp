@@ -16,6 +16,12 @@ namespace Jacker {
 
 class TrackBar : public Gtk::HBox {
 public:
+    enum {
+        // ports are grouped into submenus
+        PortsPerMenu = 16,
+        PortMenuCount = (MaxPorts + PortsPerMenu - 1) / PortsPerMenu,
+    };
+    
     TrackBar(int index, class TrackView &view);
     ~TrackBar();
     
@@ -29,9 +35,11 @@ public:
     
     Gtk::EventBox port_eventbox;
     Gtk::Menu port_menu;
+    Gtk::Menu port_submenus[PortMenuCount];
     Gtk::Label port;
     Gtk::RadioButtonGroup port_radio_group;
     Gtk::ToggleButton mute;
+    Gtk::ToggleButton solo;
 
     Model *model;
     class TrackView *view;
@@ -42,6 +50,7 @@ public:
     bool on_port_button_press_event(GdkEventButton *event);
     bool on_name_button_press_event(GdkEventButton *event);
     void on_mute_toggled();
+    void on_solo_toggled();
 
     void on_channel(int channel);
     void on_port(int port);
@@ -54,6 +63,7 @@ class TrackView : public Gtk::VBox {
 public:
     typedef std::vector<TrackBar *> TrackBarArray;    
     typedef sigc::signal<void, int, bool> type_mute_toggled;
+    typedef sigc::signal<void, int, bool> type_solo_toggled;
 
     TrackView(BaseObjectType* cobject, 
             const Glib::RefPtr<Gtk::Builder>& builder);
@@ -63,6 +73,7 @@ public:
     Glib::RefPtr<Gtk::SizeGroup> group_channels;
     Glib::RefPtr<Gtk::SizeGroup> group_ports;
     Glib::RefPtr<Gtk::SizeGroup> group_mutes;
+    Glib::RefPtr<Gtk::SizeGroup> group_solos;
 
     Model *model;
     TrackBarArray bars;
@@ -72,9 +83,11 @@ public:
     void update_tracks();
 
     type_mute_toggled signal_mute_toggled();
+    type_solo_toggled signal_solo_toggled();
 
 protected:
     type_mute_toggled _mute_toggled;
+    type_solo_toggled _solo_toggled;
 };
 
 //=============================================================================